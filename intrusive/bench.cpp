@@ -0,0 +1,162 @@
+#include "compressed.h"
+
+#include "../shared-from-this/shared.h"
+
+#include <catch.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Runs `body` once and prints the average time of one of its `ops` operations
+template <typename F>
+void Measure(const std::string& name, size_t ops, F&& body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << elapsed.count() / ops << " ns/op" << std::endl;
+}
+
+struct FullNode : SimpleRefCounted<FullNode> {
+    int value = 1;
+    std::vector<IntrusivePtr<FullNode>> edges;
+};
+
+struct CompressedNode : CageRefCounted<CompressedNode> {
+    int value = 1;
+    std::vector<CompressedIntrusivePtr<CompressedNode>> edges;
+};
+
+// Adjacency lists of a random graph: memory taken by the edges and a pass over all of them
+template <typename Node, typename Make>
+void MeasureGraph(const std::string& name, Make make) {
+    constexpr size_t kNodes = 100'000;
+    constexpr size_t kDegree = 16;
+
+    using Ptr = decltype(make());
+    std::vector<Ptr> nodes;
+    for (size_t i = 0; i < kNodes; ++i) {
+        nodes.push_back(make());
+    }
+    uint64_t random = 42;
+    for (auto& node : nodes) {
+        node->edges.reserve(kDegree);
+        for (size_t i = 0; i < kDegree; ++i) {
+            random = random * 6364136223846793005 + 1442695040888963407;
+            node->edges.push_back(nodes[(random >> 33) % kNodes]);
+        }
+    }
+
+    std::cout << name << ": " << kNodes * kDegree * sizeof(Ptr) / (1 << 20)
+              << " MiB of edges, sizeof(Node) = " << sizeof(Node) << std::endl;
+    int sum = 0;
+    Measure(name + " edge traversal", kNodes * kDegree, [&] {
+        for (const auto& node : nodes) {
+            for (const auto& edge : node->edges) {
+                sum += edge->value;
+            }
+        }
+    });
+    REQUIRE(sum == static_cast<int>(kNodes * kDegree));
+
+    // Break the cycles
+    for (auto& node : nodes) {
+        node->edges.clear();
+    }
+}
+
+struct ThreadSafeInt : ThreadSafeRefCounted<ThreadSafeInt> {
+    int value = 42;
+};
+
+constexpr size_t kIterations = 1'000'000;
+
+// Keeps the compiler from optimizing away the pointer copies being measured
+template <typename T>
+void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Every thread copies and destroys pointers `kIterations` times
+template <typename Body>
+void MeasureThreads(const std::string& name, size_t threads, Body body) {
+    Measure(name + ", " + std::to_string(threads) + " threads", kIterations * threads, [&] {
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(body);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    });
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Pointer size") {
+    std::cout << "sizeof(IntrusivePtr) = " << sizeof(IntrusivePtr<FullNode>)
+              << ", sizeof(CompressedIntrusivePtr) = "
+              << sizeof(CompressedIntrusivePtr<CompressedNode>)
+              << ", sizeof(CompressedSharedPtr) = " << sizeof(CompressedSharedPtr<int>)
+              << std::endl;
+}
+
+TEST_CASE("Graph") {
+    MeasureGraph<FullNode>("IntrusivePtr", [] { return IntrusivePtr<FullNode>(new FullNode()); });
+    MeasureGraph<CompressedNode>("CompressedIntrusivePtr",
+                                 [] { return MakeCompressedIntrusive<CompressedNode>(); });
+}
+
+// One object shared by all threads against one object per thread
+TEST_CASE("Multi-threaded copy/destroy") {
+    for (size_t threads = 1; threads <= 4; threads *= 2) {
+        auto intrusive = MakeIntrusive<ThreadSafeInt>();
+        MeasureThreads("IntrusivePtr (AtomicCounter) copy + destroy, one object", threads, [&] {
+            for (size_t i = 0; i < kIterations; ++i) {
+                IntrusivePtr<ThreadSafeInt> copy(intrusive);
+                DoNotOptimize(copy);
+            }
+        });
+
+        auto shared = MakeShared<int>(42);
+        MeasureThreads("SharedPtr (atomic) copy + destroy, one object", threads, [&] {
+            for (size_t i = 0; i < kIterations; ++i) {
+                SharedPtr<int> copy(shared);
+                DoNotOptimize(copy);
+            }
+        });
+
+        MeasureThreads("IntrusivePtr (AtomicCounter) copy + destroy, private objects", threads, [] {
+            auto own = MakeIntrusive<ThreadSafeInt>();
+            for (size_t i = 0; i < kIterations; ++i) {
+                IntrusivePtr<ThreadSafeInt> copy(own);
+                DoNotOptimize(copy);
+            }
+        });
+
+        MeasureThreads("SharedPtr (atomic) copy + destroy, private objects", threads, [] {
+            auto own = MakeShared<int>(42);
+            for (size_t i = 0; i < kIterations; ++i) {
+                SharedPtr<int> copy(own);
+                DoNotOptimize(copy);
+            }
+        });
+    }
+
+    MeasureThreads("IntrusivePtr (SimpleCounter) copy + destroy, private objects", 1, [] {
+        IntrusivePtr<FullNode> own(new FullNode());
+        for (size_t i = 0; i < kIterations; ++i) {
+            IntrusivePtr<FullNode> copy(own);
+            DoNotOptimize(copy);
+        }
+    });
+}
@@ -0,0 +1,388 @@
+#pragma once
+
+#include "intrusive.h"
+
+#include <atomic>
+#include <cstddef>  // for std::nullptr_t
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>  // for std::exchange / std::swap
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#error "PointerCage needs a way to reserve address space without backing it"
+#endif
+
+class BadCompressedIntrusivePtr : public std::exception {};
+
+// Pointer compression in the style of V8: objects live in a single process-wide region (the
+// cage) of at most 4 GiB, so a pointer to them fits into a 32-bit offset from the cage base and
+// is decoded with one addition. Offset zero is never handed out and stands for `nullptr`.
+//
+// The cage reserves its address space on the first allocation without making it accessible, and
+// commits it in steps of `kCommitStep` as it fills up. Either failing throws `std::bad_alloc`.
+// Freed memory is reused by allocations of the same size class; memory of larger objects is not
+// reused.
+class PointerCage {
+public:
+    static constexpr size_t kSize = size_t{1} << 32;
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxReusedSize = 1024;
+    static constexpr size_t kCommitStep = size_t{1} << 20;
+
+    // Null before the first allocation. Whoever holds an offset has seen that allocation, so a
+    // relaxed load is enough
+    static char* Base() noexcept {
+        return base.load(std::memory_order_relaxed);
+    }
+
+    static uint32_t Compress(const void* ptr) noexcept {
+        if (ptr == nullptr) {
+            return 0;
+        }
+        return static_cast<uint32_t>(static_cast<const char*>(ptr) - Base());
+    }
+
+    // Never null for a non-zero offset: no check on the dereference path
+    static void* Decompress(uint32_t offset) noexcept {
+        return Base() + offset;
+    }
+
+    static bool Contains(const void* ptr) noexcept {
+        char* cage = Base();
+        auto address = static_cast<const char*>(ptr);
+        return cage != nullptr && address >= cage + kGranularity && address < cage + kSize;
+    }
+
+    // Aligned to `kGranularity`
+    static void* Allocate(size_t size) {
+        size = RoundUp(size, kGranularity);
+        std::lock_guard guard(lock);
+        if (size <= kMaxReusedSize && free_lists[ClassOf(size)] != nullptr) {
+            FreeSlot* slot = free_lists[ClassOf(size)];
+            free_lists[ClassOf(size)] = slot->next;
+            return slot;
+        }
+        if (kSize - used < size) {
+            throw std::bad_alloc();
+        }
+
+        char* cage = Base();
+        if (cage == nullptr) {
+            cage = Reserve();
+            base.store(cage, std::memory_order_relaxed);
+        }
+        if (used + size > committed) {
+            size_t end = RoundUp(used + size, kCommitStep);
+            Commit(cage + committed, end - committed);
+            committed = end;
+        }
+        return cage + std::exchange(used, used + size);
+    }
+
+    static void Deallocate(void* ptr, size_t size) noexcept {
+        size = RoundUp(size, kGranularity);
+        if (size > kMaxReusedSize) {
+            return;
+        }
+        std::lock_guard guard(lock);
+        auto slot = static_cast<FreeSlot*>(ptr);
+        slot->next = free_lists[ClassOf(size)];
+        free_lists[ClassOf(size)] = slot;
+    }
+
+private:
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    static size_t RoundUp(size_t size, size_t step) noexcept {
+        return size == 0 ? step : (size + step - 1) / step * step;
+    }
+
+    static size_t ClassOf(size_t size) noexcept {
+        return size / kGranularity - 1;
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    static char* Reserve() {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+        flags |= MAP_NORESERVE;
+#endif
+        void* region = mmap(nullptr, kSize, PROT_NONE, flags, -1, 0);
+        if (region == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        return static_cast<char*>(region);
+    }
+
+    static void Commit(char* start, size_t size) {
+        if (mprotect(start, size, PROT_READ | PROT_WRITE) != 0) {
+            throw std::bad_alloc();
+        }
+    }
+#else
+    static char* Reserve() {
+        void* region = VirtualAlloc(nullptr, kSize, MEM_RESERVE, PAGE_NOACCESS);
+        if (region == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<char*>(region);
+    }
+
+    static void Commit(char* start, size_t size) {
+        if (VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE) == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+#endif
+
+    static inline std::atomic<char*> base = nullptr;
+
+    static inline std::mutex lock;
+    static inline FreeSlot* free_lists[kMaxReusedSize / kGranularity] = {};
+    static inline size_t used = kGranularity;  // offset zero is `nullptr`
+    static inline size_t committed = 0;
+};
+
+// Deleter for objects created in the cage. It frees `sizeof(T)` bytes, so the object must have
+// been made as exactly the `Derived` of its `CageRefCounted` base: `MakeCompressedIntrusive`
+// checks that
+struct CageDelete {
+    template <typename T>
+    static void Destroy(T* object) {
+        object->~T();
+        PointerCage::Deallocate(object, sizeof(T));
+    }
+};
+
+template <typename Derived, typename Counter = SimpleCounter>
+using CageRefCounted = RefCounted<Derived, Counter, CageDelete>;
+
+// `IntrusivePtr` in 32 bits. `T` must live in the cage: create it with `MakeCompressedIntrusive`
+// and let it derive from `CageRefCounted`
+template <typename T>
+class CompressedIntrusivePtr {
+    template <typename Y>
+    friend class CompressedIntrusivePtr;
+
+public:
+    // Constructors
+    CompressedIntrusivePtr() noexcept {
+    }
+
+    CompressedIntrusivePtr(std::nullptr_t) noexcept {
+    }
+
+    // Throws `BadCompressedIntrusivePtr` if `other` points outside the cage
+    CompressedIntrusivePtr(const IntrusivePtr<T>& other) {
+        if (other && !PointerCage::Contains(other.Get())) {
+            throw BadCompressedIntrusivePtr();
+        }
+        offset_ = PointerCage::Compress(other.Get());
+        if (*this) {
+            Get()->IncRef();
+        }
+    }
+
+    template <typename Y>
+    CompressedIntrusivePtr(const CompressedIntrusivePtr<Y>& other) noexcept {
+        offset_ = PointerCage::Compress(static_cast<T*>(other.Get()));
+        if (*this) {
+            Get()->IncRef();
+        }
+    }
+
+    CompressedIntrusivePtr(const CompressedIntrusivePtr& other) noexcept {
+        offset_ = other.offset_;
+        if (*this) {
+            Get()->IncRef();
+        }
+    }
+
+    CompressedIntrusivePtr(CompressedIntrusivePtr&& other) noexcept {
+        offset_ = std::exchange(other.offset_, 0);
+    }
+
+    // `operator=`-s
+    CompressedIntrusivePtr& operator=(const CompressedIntrusivePtr& other) noexcept {
+        CompressedIntrusivePtr<T>(other).Swap(*this);
+        return *this;
+    }
+
+    CompressedIntrusivePtr& operator=(CompressedIntrusivePtr&& other) noexcept {
+        CompressedIntrusivePtr<T>(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    // Destructor
+    ~CompressedIntrusivePtr() {
+        if (offset_ == 0) {
+            return;
+        }
+
+        Get()->DecRef();
+    }
+
+    // Conversion to the full-width pointer
+    operator IntrusivePtr<T>() const noexcept {
+        if (offset_ == 0) {
+            return nullptr;
+        }
+        return IntrusivePtr<T>(Get());
+    }
+
+    // Modifiers
+    void Reset() {
+        CompressedIntrusivePtr<T>().Swap(*this);
+    }
+
+    void Swap(CompressedIntrusivePtr& other) {
+        std::swap(offset_, other.offset_);
+    }
+
+    // Observers
+    T* Get() const noexcept {
+        if (offset_ == 0) {
+            return nullptr;
+        }
+
+        return static_cast<T*>(PointerCage::Decompress(offset_));
+    }
+
+    T& operator*() const noexcept {
+        return *static_cast<T*>(PointerCage::Decompress(offset_));
+    }
+
+    T* operator->() const noexcept {
+        return static_cast<T*>(PointerCage::Decompress(offset_));
+    }
+
+    size_t UseCount() const noexcept {
+        if (offset_ == 0) {
+            return 0;
+        }
+
+        return Get()->RefCount();
+    }
+
+    explicit operator bool() const noexcept {
+        return offset_ != 0;
+    }
+
+    template <typename T_, typename... Args>
+    friend CompressedIntrusivePtr<T_> MakeCompressedIntrusive(Args&&... args);
+
+private:
+    uint32_t offset_ = 0;
+};
+
+template <typename T, typename U>
+inline bool operator==(const CompressedIntrusivePtr<T>& left,
+                       const CompressedIntrusivePtr<U>& right) {
+    return left.Get() == right.Get();
+}
+
+// Deduces the `Derived` that `T` gives to its `CageRefCounted` base
+template <typename Derived, typename Counter>
+Derived* CageDerivedOf(const RefCounted<Derived, Counter, CageDelete>*);
+
+template <typename T, typename... Args>
+CompressedIntrusivePtr<T> MakeCompressedIntrusive(Args&&... args) {
+    static_assert(std::is_same_v<decltype(CageDerivedOf(static_cast<T*>(nullptr))), T*>,
+                  "The cage frees sizeof(Derived): make objects of exactly that type");
+    static_assert(alignof(T) <= PointerCage::kGranularity,
+                  "The cage aligns its allocations to kGranularity only");
+    void* memory = PointerCage::Allocate(sizeof(T));
+    T* object;
+    try {
+        object = new (memory) T(std::forward<Args>(args)...);
+    } catch (...) {
+        PointerCage::Deallocate(memory, sizeof(T));
+        throw;
+    }
+
+    CompressedIntrusivePtr<T> compressed;
+    compressed.offset_ = PointerCage::Compress(object);
+    object->IncRef();
+    return compressed;
+}
+
+// The counter and a value of any type in one cage allocation, like `MakeShared` does
+template <typename T>
+struct CageBox : CageRefCounted<CageBox<T>> {
+    template <typename... Args>
+    explicit CageBox(Args&&... args) : value(std::forward<Args>(args)...) {
+    }
+
+    T value;
+};
+
+// Shared ownership of any `T` in 32 bits, without weak references
+template <typename T>
+class CompressedSharedPtr {
+public:
+    // Constructors
+    CompressedSharedPtr() noexcept {
+    }
+
+    CompressedSharedPtr(std::nullptr_t) noexcept {
+    }
+
+    // Modifiers
+    void Reset() {
+        box_.Reset();
+    }
+
+    void Swap(CompressedSharedPtr& other) {
+        box_.Swap(other.box_);
+    }
+
+    // Observers
+    T* Get() const noexcept {
+        return box_ ? &box_->value : nullptr;
+    }
+
+    T& operator*() const noexcept {
+        return box_->value;
+    }
+
+    T* operator->() const noexcept {
+        return &box_->value;
+    }
+
+    size_t UseCount() const noexcept {
+        return box_.UseCount();
+    }
+
+    explicit operator bool() const noexcept {
+        return static_cast<bool>(box_);
+    }
+
+    template <typename T_, typename... Args>
+    friend CompressedSharedPtr<T_> MakeCompressedShared(Args&&... args);
+
+private:
+    CompressedIntrusivePtr<CageBox<T>> box_;
+};
+
+template <typename T, typename U>
+inline bool operator==(const CompressedSharedPtr<T>& left, const CompressedSharedPtr<U>& right) {
+    return left.Get() == right.Get();
+}
+
+template <typename T, typename... Args>
+CompressedSharedPtr<T> MakeCompressedShared(Args&&... args) {
+    static_assert(alignof(T) <= PointerCage::kGranularity,
+                  "The cage aligns its allocations to kGranularity only");
+    CompressedSharedPtr<T> shared;
+    shared.box_ = MakeCompressedIntrusive<CageBox<T>>(std::forward<Args>(args)...);
+    return shared;
+}
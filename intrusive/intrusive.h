@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>  // for std::nullptr_t
 #include <utility>  // for std::exchange / std::swap
 
@@ -21,6 +22,29 @@ private:
     size_t count_ = 0;
 };
 
+// For objects whose `IntrusivePtr`s are copied and destroyed in different threads. A decrement
+// releases the owner's writes to the object, and the last one acquires all of them before the
+// object is destroyed. Increments need no ordering: the new owner already holds a reference
+class AtomicCounter {
+public:
+    AtomicCounter() noexcept = default;
+
+    size_t IncRef() noexcept {
+        return count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    size_t DecRef() noexcept {
+        return count_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+
+    size_t RefCount() const noexcept {
+        return count_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::atomic<size_t> count_ = 0;
+};
+
 struct DefaultDelete {
     template <typename T>
     static void Destroy(T* object) {
@@ -31,20 +55,30 @@ struct DefaultDelete {
 template <typename Derived, typename Counter, typename Deleter>
 class RefCounted {
 public:
+    RefCounted() = default;
+
+    // The count belongs to the object's identity: copies start from zero, and assigning a value
+    // keeps the references to the target
+    RefCounted(const RefCounted&) noexcept {
+    }
+
+    RefCounted& operator=(const RefCounted&) noexcept {
+        return *this;
+    }
+
     // Increase reference counter.
     void IncRef() {
         counter_.IncRef();
     }
 
     // Decrease reference counter.
-    // Destroy object using Deleter when the last instance dies.
+    // Destroy object using Deleter when the last instance dies. The only reference is dropped
+    // without a decrement: nobody else can take a new one. Otherwise the decrement itself tells
+    // which one was the last, as two owners may both see a count of two
     void DecRef() {
-        if (RefCount() <= 1) {
+        if (RefCount() == 1 || counter_.DecRef() == 0) {
             Deleter::Destroy(static_cast<Derived*>(this));
-            return;
         }
-
-        counter_.DecRef();
     }
 
     // Get current counter value (the number of strong references).
@@ -59,6 +93,9 @@ private:
 template <typename Derived, typename D = DefaultDelete>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+template <typename Derived, typename D = DefaultDelete>
+using ThreadSafeRefCounted = RefCounted<Derived, AtomicCounter, D>;
+
 template <typename T>
 class IntrusivePtr {
     template <typename Y>
@@ -170,13 +207,20 @@ public:
         return ptr_->RefCount();
     }
 
+    // Does not read the counter, which other threads may be updating
     explicit operator bool() const noexcept {
-        return UseCount() != 0;
+        return ptr_ != nullptr;
     }
 
     template <typename T_, typename... Args>
     friend IntrusivePtr<T_> MakeIntrusive(Args&&... args);
 
+    template <typename T_, typename U>
+    friend IntrusivePtr<T_> StaticPointerCast(IntrusivePtr<U>&& intrusive) noexcept;
+
+    template <typename T_, typename U>
+    friend IntrusivePtr<T_> DynamicPointerCast(IntrusivePtr<U>&& intrusive) noexcept;
+
 private:
     T* ptr_ = nullptr;
 };
@@ -188,3 +232,35 @@ IntrusivePtr<T> MakeIntrusive(Args&&... args) {
     intrusive.ptr_->IncRef();
     return intrusive;
 }
+
+// The rvalue overloads move the reference into the result instead of copying it
+template <typename T, typename U>
+IntrusivePtr<T> StaticPointerCast(const IntrusivePtr<U>& intrusive) noexcept {
+    return StaticPointerCast<T>(IntrusivePtr<U>(intrusive));
+}
+
+template <typename T, typename U>
+IntrusivePtr<T> StaticPointerCast(IntrusivePtr<U>&& intrusive) noexcept {
+    IntrusivePtr<T> result;
+    result.ptr_ = static_cast<T*>(std::exchange(intrusive.ptr_, nullptr));
+    return result;
+}
+
+// Returns an empty pointer if the cast fails, leaving `intrusive` as it was
+template <typename T, typename U>
+IntrusivePtr<T> DynamicPointerCast(const IntrusivePtr<U>& intrusive) noexcept {
+    if (auto ptr = dynamic_cast<T*>(intrusive.Get())) {
+        return IntrusivePtr<T>(ptr);
+    }
+    return nullptr;
+}
+
+template <typename T, typename U>
+IntrusivePtr<T> DynamicPointerCast(IntrusivePtr<U>&& intrusive) noexcept {
+    IntrusivePtr<T> result;
+    if (auto ptr = dynamic_cast<T*>(intrusive.ptr_)) {
+        result.ptr_ = ptr;
+        intrusive.ptr_ = nullptr;
+    }
+    return result;
+}
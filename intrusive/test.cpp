@@ -4,7 +4,10 @@
 
 #include "allocations_checker.h"
 
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -110,6 +113,75 @@ TEST_CASE("Conversions") {
     REQUIRE(foo->Kek() == 42);
 }
 
+// Counts every update of every counter
+class CountingCounter : public SimpleCounter {
+public:
+    size_t IncRef() noexcept {
+        ++increments;
+        return SimpleCounter::IncRef();
+    }
+
+    size_t DecRef() noexcept {
+        ++decrements;
+        return SimpleCounter::DecRef();
+    }
+
+    static inline size_t increments = 0;
+    static inline size_t decrements = 0;
+};
+
+struct Shape : RefCounted<Shape, CountingCounter, DefaultDelete> {
+    virtual ~Shape() = default;
+};
+
+struct Circle : Shape {
+    explicit Circle(int radius) : radius{radius} {
+    }
+
+    int radius;
+};
+
+struct Square : Shape {};
+
+TEST_CASE("Pointer casts") {
+    IntrusivePtr<Shape> shape = MakeIntrusive<Circle>(2);
+
+    SECTION("Copy") {
+        auto increments = CountingCounter::increments;
+        IntrusivePtr<Circle> circle = StaticPointerCast<Circle>(shape);
+        REQUIRE(circle->radius == 2);
+        REQUIRE(shape.UseCount() == 2);
+        REQUIRE(CountingCounter::increments == increments + 1);
+
+        REQUIRE(DynamicPointerCast<Circle>(shape).Get() == circle.Get());
+        REQUIRE(DynamicPointerCast<Square>(shape).Get() == nullptr);
+        REQUIRE(shape.UseCount() == 2);
+    }
+
+    SECTION("Move") {
+        auto increments = CountingCounter::increments;
+        auto decrements = CountingCounter::decrements;
+
+        IntrusivePtr<Circle> circle = StaticPointerCast<Circle>(std::move(shape));
+        REQUIRE(shape.Get() == nullptr);
+        REQUIRE(circle->radius == 2);
+
+        shape = DynamicPointerCast<Shape>(std::move(circle));
+        REQUIRE(circle.Get() == nullptr);
+        circle = DynamicPointerCast<Circle>(std::move(shape));
+        REQUIRE(shape.Get() == nullptr);
+
+        REQUIRE(circle.UseCount() == 1);
+        REQUIRE(CountingCounter::increments == increments);
+        REQUIRE(CountingCounter::decrements == decrements);
+    }
+
+    SECTION("Failed dynamic cast keeps the source") {
+        REQUIRE(DynamicPointerCast<Square>(std::move(shape)).Get() == nullptr);
+        REQUIRE(shape.UseCount() == 1);
+    }
+}
+
 template <typename T>
 class ObjectCounters {
 public:
@@ -397,3 +469,59 @@ TEST_CASE("Object pool") {
         REQUIRE(strs.NumInUse() == 1);
     }
 }
+
+struct SharedCounter : ThreadSafeRefCounted<SharedCounter> {
+    static inline std::atomic<int> alive = 0;
+
+    SharedCounter() {
+        ++alive;
+    }
+
+    ~SharedCounter() {
+        --alive;
+    }
+
+    int value = 42;
+};
+
+TEST_CASE("Thread-safe counter") {
+    constexpr int kThreads = 4;
+    constexpr int kCopies = 10'000;
+
+    SECTION("Copies in many threads") {
+        auto shared = MakeIntrusive<SharedCounter>();
+        std::atomic<bool> intact = true;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([&shared, &intact] {
+                for (int j = 0; j < kCopies; ++j) {
+                    IntrusivePtr<SharedCounter> copy = shared;
+                    if (copy->value != 42) {
+                        intact = false;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(intact);
+        REQUIRE(shared.UseCount() == 1);
+    }
+
+    SECTION("Last owners race") {
+        for (int i = 0; i < 1'000; ++i) {
+            auto shared = MakeIntrusive<SharedCounter>();
+            std::vector<std::thread> threads;
+            for (int j = 0; j < kThreads; ++j) {
+                threads.emplace_back([copy = shared]() mutable { copy.Reset(); });
+            }
+            shared.Reset();
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+    }
+
+    REQUIRE(SharedCounter::alive == 0);
+}
@@ -0,0 +1,154 @@
+#include "compressed.h"
+
+#include <catch.hpp>
+
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct CagedInt : CageRefCounted<CagedInt> {
+    static inline int alive = 0;
+
+    CagedInt(int value) : value{value} {
+        ++alive;
+    }
+
+    ~CagedInt() {
+        --alive;
+    }
+
+    int value = 0;
+};
+
+TEST_CASE("PointerCage") {
+    SECTION("Round trip") {
+        void* memory = PointerCage::Allocate(24);
+        REQUIRE(PointerCage::Contains(memory));
+        REQUIRE(PointerCage::Compress(memory) != 0);
+        REQUIRE(PointerCage::Decompress(PointerCage::Compress(memory)) == memory);
+        REQUIRE(PointerCage::Compress(nullptr) == 0);
+        PointerCage::Deallocate(memory, 24);
+    }
+
+    SECTION("Freed memory is reused") {
+        void* first = PointerCage::Allocate(40);
+        PointerCage::Deallocate(first, 40);
+        void* second = PointerCage::Allocate(48);
+        REQUIRE(second == first);
+        PointerCage::Deallocate(second, 48);
+    }
+
+    SECTION("Committed as it grows") {
+        std::vector<char*> large;
+        for (int i = 0; i < 3; ++i) {
+            large.push_back(static_cast<char*>(PointerCage::Allocate(PointerCage::kCommitStep)));
+        }
+        for (char* memory : large) {
+            REQUIRE(PointerCage::Contains(memory));
+            memory[0] = 1;
+            memory[PointerCage::kCommitStep - 1] = 1;
+        }
+    }
+
+    SECTION("Foreign pointers") {
+        int local = 0;
+        REQUIRE(!PointerCage::Contains(&local));
+        REQUIRE(!PointerCage::Contains(nullptr));
+    }
+}
+
+struct KeepAlive {
+    template <typename T>
+    static void Destroy(T*) {
+    }
+};
+
+struct OnStack : SimpleRefCounted<OnStack, KeepAlive> {};
+
+TEST_CASE("CompressedIntrusivePtr") {
+    SECTION("Sizeof") {
+        static_assert(sizeof(CompressedIntrusivePtr<CagedInt>) == sizeof(uint32_t));
+        static_assert(sizeof(CompressedSharedPtr<std::string>) == sizeof(uint32_t));
+    }
+
+    SECTION("Empty") {
+        CompressedIntrusivePtr<CagedInt> a, b(nullptr);
+        a = b;
+        REQUIRE(a.Get() == nullptr);
+        REQUIRE(a.UseCount() == 0);
+        REQUIRE(!b);
+        REQUIRE(IntrusivePtr<CagedInt>(a).Get() == nullptr);
+    }
+
+    SECTION("Copy/move") {
+        {
+            auto a = MakeCompressedIntrusive<CagedInt>(42);
+            auto b = a;
+            CompressedIntrusivePtr<CagedInt> c(std::move(a));
+            REQUIRE(!a);
+            REQUIRE(c.UseCount() == 2);
+            REQUIRE(c->value == 42);
+            REQUIRE((*b).value == 42);
+            REQUIRE(b == c);
+            REQUIRE(CagedInt::alive == 1);
+        }
+        REQUIRE(CagedInt::alive == 0);
+    }
+
+    SECTION("Full-width pointers share the count") {
+        auto compressed = MakeCompressedIntrusive<CagedInt>(7);
+        IntrusivePtr<CagedInt> full = compressed;
+        REQUIRE(full.Get() == compressed.Get());
+        REQUIRE(full.UseCount() == 2);
+
+        compressed.Reset();
+        CompressedIntrusivePtr<CagedInt> back(full);
+        REQUIRE(back->value == 7);
+        REQUIRE(back.UseCount() == 2);
+        full.Reset();
+        back.Reset();
+        REQUIRE(CagedInt::alive == 0);
+    }
+
+    SECTION("Full-width pointers outside the cage") {
+        OnStack object;
+        IntrusivePtr<OnStack> full(&object);
+        REQUIRE_THROWS_AS(CompressedIntrusivePtr<OnStack>(full), BadCompressedIntrusivePtr);
+        REQUIRE(full.UseCount() == 1);
+        REQUIRE(!CompressedIntrusivePtr<OnStack>(IntrusivePtr<OnStack>()));
+    }
+
+    SECTION("Throwing constructor") {
+        struct Throwing : CageRefCounted<Throwing> {
+            Throwing() {
+                throw std::runtime_error("no");
+            }
+        };
+        REQUIRE_THROWS_AS(MakeCompressedIntrusive<Throwing>(), std::runtime_error);
+    }
+}
+
+TEST_CASE("CompressedSharedPtr") {
+    SECTION("Any type") {
+        auto a = MakeCompressedShared<std::string>("abacaba");
+        auto b = a;
+        REQUIRE(*b == "abacaba");
+        REQUIRE(a->size() == 7);
+        REQUIRE(a.UseCount() == 2);
+        REQUIRE(a == b);
+        REQUIRE(PointerCage::Contains(a.Get()));
+        a.Reset();
+        REQUIRE(b.UseCount() == 1);
+    }
+
+    SECTION("Many objects") {
+        std::vector<CompressedSharedPtr<int>> all;
+        for (int i = 0; i < 10'000; ++i) {
+            all.push_back(MakeCompressedShared<int>(i));
+        }
+        for (int i = 0; i < 10'000; ++i) {
+            REQUIRE(*all[i] == i);
+        }
+    }
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+
+#include "shared.h"
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/atomic2
+//
+// Lock-free thanks to split reference counting. The published `SharedPtr` (even an empty one)
+// lives in an immutable heap node, and the atomic word packs the node address (low 48 bits,
+// enough for x86-64 user space) with the number of readers currently borrowing that node
+// (high 16 bits).
+// A reader borrows the node with one `fetch_add`, copies the `SharedPtr` out of it and gives the
+// borrow back. If the node was replaced meanwhile, the borrow is returned to the node's own
+// counter instead, and whoever brings that counter to zero deletes the node.
+template <typename T>
+class AtomicSharedPtr {
+    static_assert(BlockCounters::kThreadSafe, "AtomicSharedPtr needs thread-safe counters");
+    static_assert(sizeof(void*) == sizeof(uint64_t) && std::atomic<uint64_t>::is_always_lock_free);
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    AtomicSharedPtr() : AtomicSharedPtr(SharedPtr<T>()) {
+    }
+
+    AtomicSharedPtr(SharedPtr<T> desired) : word_(Pack(new Node(std::move(desired)))) {
+    }
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~AtomicSharedPtr() {
+        Retire(word_.load(std::memory_order_acquire));
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Atomic operations
+
+    SharedPtr<T> Load() const {
+        uint64_t word = Borrow();
+        SharedPtr<T> result = NodeOf(word)->value;
+        GiveBack(word);
+        return result;
+    }
+
+    void Store(SharedPtr<T> desired) {
+        Exchange(std::move(desired));
+    }
+
+    SharedPtr<T> Exchange(SharedPtr<T> desired) {
+        Node* node = new Node(std::move(desired));
+        return Retire(word_.exchange(Pack(node), std::memory_order_acq_rel));
+    }
+
+    // Replaces the value if it still equals `expected` (same pointer, same owner), otherwise
+    // loads the current value into `expected`
+    bool CompareExchange(SharedPtr<T>& expected, SharedPtr<T> desired) {
+        Node* desired_node = new Node(std::move(desired));
+        uint64_t word = Borrow();
+
+        while (true) {
+            Node* node = NodeOf(word);
+            if (!Holds(node, expected)) {
+                expected = node->value;
+                GiveBack(word);
+                delete desired_node;
+                return false;
+            }
+
+            uint64_t current = word;
+            if (word_.compare_exchange_weak(current, Pack(desired_node), std::memory_order_acq_rel,
+                                            std::memory_order_relaxed)) {
+                // Our own borrow is among the ones being retired: return it right away
+                Retire(current - kOneBorrow);
+                return true;
+            }
+
+            if (NodeOf(current) == node) {
+                word = current;
+            } else {
+                // Someone else replaced the node: start over with the new one
+                GiveBack(word);
+                word = Borrow();
+            }
+        }
+    }
+
+    bool IsLockFree() const noexcept {
+        return word_.is_lock_free();
+    }
+
+private:
+    struct Node {
+        explicit Node(SharedPtr<T> desired) : value(std::move(desired)) {
+        }
+
+        SharedPtr<T> value;
+
+        // Borrows still outstanding once the node is no longer published; goes negative when
+        // readers give back before the replacing thread accounts for them
+        std::atomic<int64_t> borrows = 0;
+    };
+
+    static constexpr int kPointerBits = 48;
+    static constexpr uint64_t kPointerMask = (uint64_t{1} << kPointerBits) - 1;
+    static constexpr uint64_t kOneBorrow = uint64_t{1} << kPointerBits;
+
+    static uint64_t Pack(Node* node) noexcept {
+        return reinterpret_cast<uint64_t>(node);
+    }
+
+    static Node* NodeOf(uint64_t word) noexcept {
+        return reinterpret_cast<Node*>(word & kPointerMask);
+    }
+
+    static uint64_t BorrowsOf(uint64_t word) noexcept {
+        return word >> kPointerBits;
+    }
+
+    static bool Holds(Node* node, const SharedPtr<T>& expected) noexcept {
+        return node->value.block_ == expected.block_ && node->value.ptr_ == expected.ptr_;
+    }
+
+    // Returns the word including the borrow just taken
+    uint64_t Borrow() const noexcept {
+        return word_.fetch_add(kOneBorrow, std::memory_order_acquire) + kOneBorrow;
+    }
+
+    void GiveBack(uint64_t word) const noexcept {
+        Node* node = NodeOf(word);
+        while (NodeOf(word) == node) {
+            if (word_.compare_exchange_weak(word, word - kOneBorrow, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+
+        // The node has been retired
+        if (node->borrows.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete node;
+        }
+    }
+
+    // Takes over a node which has just been unpublished, together with its outstanding borrows
+    static SharedPtr<T> Retire(uint64_t word) {
+        Node* node = NodeOf(word);
+        auto borrows = static_cast<int64_t>(BorrowsOf(word));
+        if (borrows == 0) {
+            SharedPtr<T> result = std::move(node->value);
+            delete node;
+            return result;
+        }
+
+        SharedPtr<T> result = node->value;
+        if (node->borrows.fetch_add(borrows, std::memory_order_acq_rel) + borrows == 0) {
+            delete node;
+        }
+        return result;
+    }
+
+    mutable std::atomic<uint64_t> word_ = 0;
+};
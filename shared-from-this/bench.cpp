@@ -0,0 +1,617 @@
+#include "block_cache.h"
+#include "compact_shared.h"
+#include "cow.h"
+#include "shared.h"
+#include "thin_weak.h"
+#include "weak.h"
+
+#if defined(SW_ATOMIC_COUNTERS) || defined(SW_BIASED_COUNTERS)
+#include "atomic_shared.h"
+#endif
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+const char* CountersName() {
+#if defined(SW_BIASED_COUNTERS)
+    return "biased";
+#elif defined(SW_ATOMIC_COUNTERS) && defined(SW_PACKED_COUNTERS)
+    return "atomic, packed";
+#elif defined(SW_ATOMIC_COUNTERS) && defined(SW_CACHED_BLOCKS)
+    return "atomic, cached blocks";
+#elif defined(SW_ATOMIC_COUNTERS)
+    return "atomic";
+#elif defined(SW_PACKED_COUNTERS)
+    return "simple, packed";
+#else
+    return "simple";
+#endif
+}
+
+// Runs `body` once and prints the average time of one of its `ops` operations
+template <typename F>
+void Measure(const std::string& name, size_t ops, F&& body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "[" << CountersName() << "] " << name << ": " << elapsed.count() / ops
+              << " ns/op" << std::endl;
+}
+
+// Keeps the compiler from optimizing away the pointer copies being measured
+template <typename T>
+void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template <typename F>
+void RunThreads(size_t num_threads, F&& body) {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&body, i] { body(i); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+constexpr size_t kIterations = 1'000'000;
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Block size") {
+    std::cout << "[" << CountersName() << "] sizeof(BaseBlock) = " << sizeof(BaseBlock)
+              << ", sizeof(ControlBlock1<int>) = " << sizeof(ControlBlock1<int>)
+              << ", sizeof(ControlBlock2<int>) = " << sizeof(ControlBlock2<int>) << std::endl;
+    std::cout << "[" << CountersName() << "] sizeof(SharedPtr<int>) = " << sizeof(SharedPtr<int>)
+              << ", sizeof(CompactSharedPtr<int>) = " << sizeof(CompactSharedPtr<int>)
+              << std::endl;
+}
+
+TEST_CASE("Copy/destroy") {
+    auto sp = MakeShared<int>(42);
+
+    Measure("SharedPtr copy + destroy", kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            SharedPtr<int> copy(sp);
+            DoNotOptimize(copy);
+        }
+    });
+
+    Measure("WeakPtr copy + destroy", kIterations, [&] {
+        WeakPtr<int> wp(sp);
+        for (size_t i = 0; i < kIterations; ++i) {
+            WeakPtr<int> copy(wp);
+            DoNotOptimize(copy);
+        }
+    });
+
+    REQUIRE(sp.UseCount() == 1);
+}
+
+struct SelfAware : EnableSharedFromThis<SelfAware> {
+    int value = 42;
+};
+
+// Copies must not touch `weak_this_`: the cost should match that of `SharedPtr<int>`
+TEST_CASE("Copy/destroy, EnableSharedFromThis") {
+    auto sp = MakeShared<SelfAware>();
+
+    Measure("SharedPtr copy + destroy, EnableSharedFromThis", kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            SharedPtr<SelfAware> copy(sp);
+            DoNotOptimize(copy);
+        }
+    });
+
+    Measure("SharedPtr move, EnableSharedFromThis", kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            SharedPtr<SelfAware> moved(std::move(sp));
+            DoNotOptimize(moved);
+            sp = std::move(moved);
+        }
+    });
+
+    REQUIRE(sp.UseCount() == 1);
+    REQUIRE(sp->WeakFromThis().UseCount() == 1);
+}
+
+struct SelfAwareEmbedded : EmbeddedSharedFromThis<SelfAwareEmbedded> {
+    int value = 42;
+};
+
+template <typename T>
+void MeasureSelfAware(const std::string& flavour) {
+    std::cout << "[" << CountersName() << "] sizeof(" << flavour << " object) = " << sizeof(T)
+              << std::endl;
+
+    Measure("SharedPtr(new T) + destroy, " + flavour, kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            SharedPtr<T> sp(new T);
+            DoNotOptimize(sp);
+        }
+    });
+
+    SharedPtr<T> sp(new T);
+    Measure("SharedPtr copy + destroy, " + flavour, kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            SharedPtr<T> copy(sp);
+            DoNotOptimize(copy);
+        }
+    });
+    Measure("SharedFromThis + destroy, " + flavour, kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            auto copy = sp->SharedFromThis();
+            DoNotOptimize(copy);
+        }
+    });
+    REQUIRE(sp.UseCount() == 1);
+}
+
+// Two allocations (object, `ControlBlock1`) against one (header + object)
+TEST_CASE("EmbeddedSharedFromThis") {
+    MeasureSelfAware<SelfAware>("EnableSharedFromThis");
+    MeasureSelfAware<SelfAwareEmbedded>("EmbeddedSharedFromThis");
+}
+
+TEST_CASE("Final release") {
+    constexpr size_t kObjects = 100'000;
+
+    std::vector<SharedPtr<int>> raw;
+    std::vector<SharedPtr<int>> made;
+    for (size_t i = 0; i < kObjects; ++i) {
+        raw.emplace_back(new int(42));
+        made.push_back(MakeShared<int>(42));
+    }
+
+    Measure("last SharedPtr release, SharedPtr(new T)", kObjects, [&] { raw.clear(); });
+    Measure("last SharedPtr release, MakeShared", kObjects, [&] { made.clear(); });
+}
+
+struct StrongOnlyInt {
+    int value;
+};
+
+template <>
+inline constexpr bool kStrongOnly<StrongOnlyInt> = true;
+
+TEST_CASE("Strong-only blocks") {
+    std::cout << "[" << CountersName() << "] sizeof(StrongBlock) = " << sizeof(StrongBlock)
+              << ", sizeof(ControlBlock2<StrongOnlyInt>) = " << sizeof(ControlBlock2<StrongOnlyInt>)
+              << std::endl;
+
+    constexpr size_t kObjects = 100'000;
+
+    std::vector<SharedPtr<int>> full;
+    std::vector<SharedPtr<StrongOnlyInt>> strong;
+    for (size_t i = 0; i < kObjects; ++i) {
+        full.push_back(MakeShared<int>(42));
+        strong.push_back(MakeShared<StrongOnlyInt>(StrongOnlyInt{42}));
+    }
+
+    Measure("last SharedPtr release, MakeShared, full block", kObjects, [&] { full.clear(); });
+    Measure("last SharedPtr release, MakeShared, strong-only block", kObjects,
+            [&] { strong.clear(); });
+
+    auto sp = MakeShared<StrongOnlyInt>(StrongOnlyInt{42});
+    Measure("SharedPtr copy + destroy, strong-only block", kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            SharedPtr<StrongOnlyInt> copy(sp);
+            DoNotOptimize(copy);
+        }
+    });
+}
+
+TEST_CASE("Slab") {
+    Measure("MakeShared + destroy", kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            DoNotOptimize(MakeShared<int>(42));
+        }
+    });
+    Measure("AllocateShared(SlabAllocator) + destroy", kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            DoNotOptimize(AllocateShared<int>(SlabAllocator<int>(), 42));
+        }
+    });
+    Measure("AllocateShared(BlockCacheAllocator) + destroy", kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            DoNotOptimize(AllocateShared<int>(BlockCacheAllocator<int>(), 42));
+        }
+    });
+
+    std::vector<int> objects(kIterations);
+    auto keep = [](int*) {};
+    Measure("SharedPtr(ptr, deleter) + destroy", kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            DoNotOptimize(SharedPtr<int>(&objects[i], keep));
+        }
+    });
+    Measure("SharedPtr(ptr, deleter, SlabAllocator) + destroy", kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            DoNotOptimize(SharedPtr<int>(&objects[i], keep, SlabAllocator<int>()));
+        }
+    });
+}
+
+// One thread creates objects, another one drops the last references to them
+template <typename Make>
+void MeasureProducerConsumer(const std::string& name, Make make) {
+    constexpr size_t kBatch = 1'000;
+
+    Measure(name, kIterations, [&] {
+        std::mutex mutex;
+        std::vector<SharedPtr<int>> queue;
+        std::atomic<bool> done = false;
+
+        std::thread consumer([&] {
+            std::vector<SharedPtr<int>> taken;
+            while (true) {
+                bool finished = done.load();
+                {
+                    std::lock_guard lock(mutex);
+                    taken.swap(queue);
+                }
+                taken.clear();
+                if (finished) {
+                    break;
+                }
+                std::this_thread::yield();
+            }
+        });
+
+        std::vector<SharedPtr<int>> batch;
+        for (size_t i = 0; i < kIterations; i += kBatch) {
+            for (size_t j = 0; j < kBatch; ++j) {
+                batch.push_back(make());
+            }
+            std::lock_guard lock(mutex);
+            queue.insert(queue.end(), std::make_move_iterator(batch.begin()),
+                         std::make_move_iterator(batch.end()));
+            batch.clear();
+        }
+        done = true;
+        consumer.join();
+    });
+}
+
+TEST_CASE("Producer/consumer") {
+    MeasureProducerConsumer("MakeShared, freed by a consumer thread",
+                            [] { return MakeShared<int>(42); });
+    MeasureProducerConsumer("AllocateShared(BlockCacheAllocator), freed by a consumer thread",
+                            [] { return AllocateShared<int>(BlockCacheAllocator<int>(), 42); });
+    MeasureProducerConsumer("AllocateShared(std::allocator), freed by a consumer thread",
+                            [] { return AllocateShared<int>(std::allocator<int>(), 42); });
+}
+
+// Adjacency lists of a random graph: memory taken by the edges and a pass over all of them
+template <template <typename> typename Ptr>
+void MeasureGraph(const std::string& name) {
+    constexpr size_t kNodes = 100'000;
+    constexpr size_t kDegree = 16;
+
+    struct Node {
+        int value = 1;
+        std::vector<Ptr<Node>> edges;
+    };
+
+    std::vector<Ptr<Node>> nodes;
+    for (size_t i = 0; i < kNodes; ++i) {
+        nodes.emplace_back(MakeShared<Node>());
+    }
+    uint64_t random = 42;
+    for (auto& node : nodes) {
+        node->edges.reserve(kDegree);
+        for (size_t i = 0; i < kDegree; ++i) {
+            random = random * 6364136223846793005 + 1442695040888963407;
+            node->edges.push_back(nodes[(random >> 33) % kNodes]);
+        }
+    }
+
+    std::cout << "[" << CountersName() << "] " << name << ": "
+              << kNodes * kDegree * sizeof(Ptr<Node>) / (1 << 20) << " MiB of edges" << std::endl;
+    int sum = 0;
+    Measure(name + " edge traversal", kNodes * kDegree, [&] {
+        for (const auto& node : nodes) {
+            for (const auto& edge : node->edges) {
+                sum += edge->value;
+            }
+        }
+    });
+    REQUIRE(sum == static_cast<int>(kNodes * kDegree));
+
+    // Break the cycles
+    for (auto& node : nodes) {
+        node->edges.clear();
+    }
+}
+
+TEST_CASE("Graph") {
+    MeasureGraph<SharedPtr>("SharedPtr");
+    MeasureGraph<CompactSharedPtr>("CompactSharedPtr");
+}
+
+// Weak references held in bulk and rarely locked
+template <typename Weak>
+void MeasureObservers(const std::string& name) {
+    constexpr size_t kEntries = 10'000'000;
+    constexpr size_t kSubjects = 1'000;
+
+    std::vector<SharedPtr<int>> subjects;
+    for (size_t i = 0; i < kSubjects; ++i) {
+        subjects.push_back(MakeShared<int>(static_cast<int>(i)));
+    }
+
+    std::vector<Weak> observers;
+    observers.reserve(kEntries);
+    Measure(name + " fill", kEntries, [&] {
+        for (size_t i = 0; i < kEntries; ++i) {
+            observers.emplace_back(subjects[i % kSubjects]);
+        }
+    });
+    std::cout << "[" << CountersName() << "] " << name << ": "
+              << observers.size() * sizeof(Weak) / (1 << 20) << " MiB for " << kEntries
+              << " entries" << std::endl;
+
+    int sum = 0;
+    Measure(name + " Lock", kEntries / 100, [&] {
+        for (size_t i = 0; i < kEntries; i += 100) {
+            sum += *observers[i].Lock();
+        }
+    });
+    DoNotOptimize(sum);
+}
+
+TEST_CASE("Observer table") {
+    MeasureObservers<WeakPtr<int>>("WeakPtr");
+    MeasureObservers<ThinWeakPtr<int>>("ThinWeakPtr");
+}
+
+TEST_CASE("Large buffers") {
+    constexpr size_t kBufferSize = 1 << 20;
+    constexpr size_t kBuffers = 1000;
+
+    Measure("MakeShared<char[]>(1 MiB) + destroy", kBuffers, [&] {
+        for (size_t i = 0; i < kBuffers; ++i) {
+            DoNotOptimize(MakeShared<char[]>(kBufferSize));
+        }
+    });
+    Measure("MakeSharedForOverwrite<char[]>(1 MiB) + destroy", kBuffers, [&] {
+        for (size_t i = 0; i < kBuffers; ++i) {
+            DoNotOptimize(MakeSharedForOverwrite<char[]>(kBufferSize));
+        }
+    });
+}
+
+// A pipeline stage that is the last owner of its input and mutates it
+TEST_CASE("TryUnwrap") {
+    constexpr size_t kBatchSize = size_t{64} << 20;
+    constexpr size_t kBatches = 10;
+
+    auto stage = [](SharedPtr<std::vector<char>>&& batch, bool unwrap) {
+        if (unwrap) {
+            if (auto unique = TryUnwrap(std::move(batch))) {
+                ++(*unique)[0];
+                return (*unique)[0];
+            }
+        }
+        std::vector<char> copy = *batch;
+        ++copy[0];
+        return copy[0];
+    };
+
+    for (bool unwrap : {false, true}) {
+        std::vector<SharedPtr<std::vector<char>>> batches;
+        for (size_t i = 0; i < kBatches; ++i) {
+            batches.push_back(MakeShared<std::vector<char>>(kBatchSize, 1));
+        }
+        int sum = 0;
+        Measure(unwrap ? "64 MiB batch, TryUnwrap" : "64 MiB batch, deep copy", kBatches, [&] {
+            for (auto& batch : batches) {
+                sum += stage(std::move(batch), unwrap);
+            }
+        });
+        REQUIRE(sum == static_cast<int>(2 * kBatches));
+    }
+}
+
+#ifndef SW_BIASED_COUNTERS
+
+// An editor keeps the last few snapshots of a document for undo, and edits it now and then
+TEST_CASE("Copy-on-write snapshots") {
+    constexpr size_t kDocumentSize = 100'000;
+    constexpr size_t kSnapshots = 1'000;
+    constexpr size_t kHistory = 10;
+    constexpr size_t kEditEvery = 100;
+
+    {
+        std::vector<int> document(kDocumentSize, 1);
+        std::vector<std::vector<int>> history(kHistory);
+        int sum = 0;
+        Measure("Snapshot, deep copy", kSnapshots, [&] {
+            for (size_t i = 0; i < kSnapshots; ++i) {
+                if (i % kEditEvery == 0) {
+                    ++document[i % kDocumentSize];
+                }
+                history[i % kHistory] = document;
+                sum += history[(i + 1) % kHistory].empty() ? 0 : history[(i + 1) % kHistory][0];
+            }
+        });
+        DoNotOptimize(sum);
+    }
+    {
+        auto document = MakeCow<std::vector<int>>(kDocumentSize, 1);
+        std::vector<CowPtr<std::vector<int>>> history(kHistory);
+        int sum = 0;
+        Measure("Snapshot, CowPtr", kSnapshots, [&] {
+            for (size_t i = 0; i < kSnapshots; ++i) {
+                if (i % kEditEvery == 0) {
+                    ++document.Write()[i % kDocumentSize];
+                }
+                history[i % kHistory] = document;
+                sum += history[(i + 1) % kHistory] ? history[(i + 1) % kHistory].Read()[0] : 0;
+            }
+        });
+        DoNotOptimize(sum);
+    }
+}
+
+#endif
+
+TEST_CASE("Multi-threaded copy/destroy") {
+    constexpr size_t kThreads = 4;
+
+    // Every thread owns a separate object: fine for both counting modes
+    Measure("SharedPtr copy + destroy, private objects", kIterations * kThreads, [&] {
+        RunThreads(kThreads, [](size_t) {
+            auto sp = MakeShared<int>(42);
+            for (size_t i = 0; i < kIterations; ++i) {
+                SharedPtr<int> copy(sp);
+                DoNotOptimize(copy);
+            }
+        });
+    });
+
+    if constexpr (BlockCounters::kThreadSafe) {
+        auto sp = MakeShared<int>(42);
+        WeakPtr<int> wp(sp);
+
+        Measure("SharedPtr copy + destroy, one object", kIterations * kThreads, [&] {
+            RunThreads(kThreads, [&](size_t) {
+                for (size_t i = 0; i < kIterations; ++i) {
+                    SharedPtr<int> copy(sp);
+                    DoNotOptimize(copy);
+                }
+            });
+        });
+
+        Measure("WeakPtr::Lock + destroy, one object", kIterations * kThreads, [&] {
+            RunThreads(kThreads, [&](size_t) {
+                for (size_t i = 0; i < kIterations; ++i) {
+                    auto locked = wp.Lock();
+                    DoNotOptimize(locked);
+                }
+            });
+        });
+
+        REQUIRE(sp.UseCount() == 1);
+
+        // Race the last strong and the last weak release
+        for (size_t i = 0; i < 10'000; ++i) {
+            auto owner = MakeShared<int>(42);
+            WeakPtr<int> observer(owner);
+            std::thread strong([owner = std::move(owner)]() mutable { owner.Reset(); });
+            std::thread weak([observer = std::move(observer)]() mutable { observer.Reset(); });
+            strong.join();
+            weak.join();
+        }
+    }
+}
+
+// One thread copies pointers to an object while another one keeps writing to it. Each thread
+// touches its own memory only, so this is fine in every counting mode
+struct HotCounter {
+    std::atomic<uint64_t> value = 0;
+};
+
+template <typename Make>
+void MeasureFalseSharing(const std::string& name, Make make) {
+    auto sp = make();
+    std::atomic<bool> done = false;
+
+    std::thread writer([&, object = sp.Get()] {
+        while (!done.load(std::memory_order_relaxed)) {
+            object->value.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    Measure(name, kIterations, [&] {
+        for (size_t i = 0; i < kIterations; ++i) {
+            SharedPtr<HotCounter> copy(sp);
+            DoNotOptimize(copy);
+        }
+    });
+    done = true;
+    writer.join();
+}
+
+TEST_CASE("False sharing") {
+    MeasureFalseSharing("SharedPtr copy + destroy next to a writer, MakeShared",
+                        [] { return MakeShared<HotCounter>(); });
+    MeasureFalseSharing("SharedPtr copy + destroy next to a writer, MakeSharedPadded",
+                        [] { return MakeSharedPadded<HotCounter>(); });
+}
+
+#if defined(SW_ATOMIC_COUNTERS) || defined(SW_BIASED_COUNTERS)
+
+// Readers copying a published pointer while a writer keeps replacing it
+TEST_CASE("AtomicSharedPtr reader scaling") {
+    constexpr size_t kLoads = 100'000;
+
+    for (size_t readers = 1; readers <= 64; readers *= 2) {
+        std::atomic<bool> done = false;
+
+        AtomicSharedPtr<int> atomic(MakeShared<int>(0));
+        std::thread atomic_writer([&] {
+            for (int i = 0; !done.load(std::memory_order_relaxed); ++i) {
+                atomic.Store(MakeShared<int>(i));
+                std::this_thread::yield();
+            }
+        });
+        Measure("AtomicSharedPtr::Load, " + std::to_string(readers) + " readers",
+                kLoads * readers, [&] {
+                    RunThreads(readers, [&](size_t) {
+                        for (size_t i = 0; i < kLoads; ++i) {
+                            auto loaded = atomic.Load();
+                            DoNotOptimize(loaded);
+                        }
+                    });
+                });
+        done = true;
+        atomic_writer.join();
+
+        done = false;
+        std::mutex mutex;
+        SharedPtr<int> guarded = MakeShared<int>(0);
+        std::thread mutex_writer([&] {
+            for (int i = 0; !done.load(std::memory_order_relaxed); ++i) {
+                auto fresh = MakeShared<int>(i);
+                {
+                    std::lock_guard lock(mutex);
+                    guarded.Swap(fresh);
+                }
+                std::this_thread::yield();
+            }
+        });
+        Measure("mutex + SharedPtr copy, " + std::to_string(readers) + " readers",
+                kLoads * readers, [&] {
+                    RunThreads(readers, [&](size_t) {
+                        for (size_t i = 0; i < kLoads; ++i) {
+                            SharedPtr<int> loaded;
+                            {
+                                std::lock_guard lock(mutex);
+                                loaded = guarded;
+                            }
+                            DoNotOptimize(loaded);
+                        }
+                    });
+                });
+        done = true;
+        mutex_writer.join();
+    }
+}
+
+#endif
@@ -0,0 +1,260 @@
+#pragma once
+
+#include "slab.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+
+// Per-thread caches of control block memory.
+//
+// Every thread takes whole runs from the slab and owns them: the header of a run points to the
+// owner's cache. A block freed by the owner goes straight back to the free list of its size
+// class. A block freed by any other thread is pushed onto the owner's lock-free "remote" list
+// (many producers, one consumer), which the owner takes over as a whole once its own free list
+// runs dry. Neither side waits for a lock, and a block released by a consumer thread ends up
+// where the producer will allocate the next one.
+//
+// When a thread exits its cache is parked together with the runs it owns, and handed over to the
+// next thread that needs one. Remote frees keep piling up in a parked cache until then. Blocks
+// the thread allocates after that, from destructors of other thread-locals, come from a shared
+// orphan cache behind a lock. Runs are never given back to the slab, and so neither to the system.
+//
+// Used by `BlockCacheAllocator`, and by `MakeShared` and `SharedPtr(T*)` with `SW_CACHED_BLOCKS`.
+class BlockCache {
+public:
+    struct Stats {
+        size_t allocations = 0;
+        size_t deallocations = 0;
+        size_t remote_deallocations = 0;  // counted when the owner collects them
+        size_t runs = 0;
+    };
+
+    // `size` must not exceed `Slab::kMaxSize`. Slots are aligned to `Slab::kGranularity`
+    static void* Allocate(size_t size) {
+        BlockCache* cache = Current();
+        if (cache != nullptr) {
+            return cache->AllocateLocal(Slab::ClassOf(size));
+        }
+        std::lock_guard guard(orphan_lock);
+        return orphan.AllocateLocal(Slab::ClassOf(size));
+    }
+
+    static void Deallocate(void* ptr) noexcept {
+        auto slot = static_cast<Slot*>(ptr);
+        Run* run = RunOf(slot);
+        if (run->owner == current) {
+            current->PushLocal(run->size_class, slot);
+            ++current->stats_.deallocations;
+        } else {
+            run->owner->PushRemote(slot);
+        }
+    }
+
+    // Takes back the blocks of the current thread freed by other threads. Happens anyway whenever
+    // the free list of a size class runs dry
+    static void Collect() noexcept {
+        if (current != nullptr) {
+            current->DrainRemote();
+        }
+    }
+
+    // Of the cache owned by the current thread
+    static Stats GetStats() noexcept {
+        return current != nullptr ? current->stats_ : Stats();
+    }
+
+private:
+    struct Slot {
+        Slot* next;
+    };
+
+    struct Run {
+        BlockCache* owner;
+        size_t size_class;
+    };
+
+    static constexpr size_t kHeaderSize = Slab::kGranularity;
+    static_assert(sizeof(Run) <= kHeaderSize);
+
+    // Takes a cache for the thread, and parks it when the thread exits. Constructed before the
+    // thread gets its first block, so that the cache is parked after the destructors of
+    // thread-locals constructed later on
+    struct Holder {
+        Holder() {
+            std::lock_guard guard(parked_lock);
+            if (parked != nullptr) {
+                current = parked;
+                parked = parked->next_parked_;
+            } else {
+                current = new BlockCache();
+            }
+        }
+
+        ~Holder() {
+            std::lock_guard guard(parked_lock);
+            current->next_parked_ = parked;
+            parked = current;
+            current = nullptr;
+            exited = true;
+        }
+    };
+
+    // Null once the thread has parked its cache: the destructors of thread-locals constructed
+    // earlier share the orphan cache from then on
+    static BlockCache* Current() {
+        if (current == nullptr && !exited) {
+            static thread_local Holder holder;
+        }
+        return current;
+    }
+
+    static Run* RunOf(Slot* slot) noexcept {
+        return reinterpret_cast<Run*>(reinterpret_cast<uintptr_t>(slot) & ~(Slab::kRunSize - 1));
+    }
+
+    void* AllocateLocal(size_t size_class) {
+        if (free_[size_class] == nullptr) {
+            DrainRemote();
+        }
+        if (free_[size_class] == nullptr) {
+            NewRun(size_class);
+        }
+        Slot* slot = free_[size_class];
+        free_[size_class] = slot->next;
+        ++stats_.allocations;
+        return slot;
+    }
+
+    void PushLocal(size_t size_class, Slot* slot) noexcept {
+        slot->next = free_[size_class];
+        free_[size_class] = slot;
+    }
+
+    void PushRemote(Slot* slot) noexcept {
+        Slot* head = remote_.load(std::memory_order_relaxed);
+        do {
+            slot->next = head;
+        } while (!remote_.compare_exchange_weak(head, slot, std::memory_order_release,
+                                                std::memory_order_relaxed));
+    }
+
+    void DrainRemote() noexcept {
+        if (remote_.load(std::memory_order_relaxed) == nullptr) {
+            return;
+        }
+
+        Slot* slot = remote_.exchange(nullptr, std::memory_order_acquire);
+        while (slot != nullptr) {
+            Slot* next = slot->next;
+            PushLocal(RunOf(slot)->size_class, slot);
+            ++stats_.remote_deallocations;
+            slot = next;
+        }
+    }
+
+    void NewRun(size_t size_class) {
+        auto run = static_cast<char*>(Slab::AllocateRun());
+        new (run) Run{this, size_class};
+
+        size_t slot_size = (size_class + 1) * Slab::kGranularity;
+        for (size_t i = (Slab::kRunSize - kHeaderSize) / slot_size; i > 0; --i) {
+            PushLocal(size_class, reinterpret_cast<Slot*>(run + kHeaderSize + (i - 1) * slot_size));
+        }
+        ++stats_.runs;
+    }
+
+    static inline thread_local BlockCache* current = nullptr;
+    static inline thread_local bool exited = false;
+
+    // Its own blocks are pushed to it as remote ones, and taken back under the lock
+    static BlockCache orphan;
+    static inline std::mutex orphan_lock;
+
+    static inline std::mutex parked_lock;
+    static inline BlockCache* parked = nullptr;
+
+    Slot* free_[Slab::kNumClasses] = {};
+    std::atomic<Slot*> remote_ = nullptr;
+    Stats stats_;
+    BlockCache* next_parked_ = nullptr;
+};
+
+inline BlockCache BlockCache::orphan;
+
+// Base for blocks allocated through `BlockCache`. Blocks built with placement new cannot use it:
+// a class `operator new` hides the global placement form
+class CachedBlock {
+public:
+    static void* operator new(size_t size) {
+        if (size <= Slab::kMaxSize) {
+            return BlockCache::Allocate(size);
+        }
+        return ::operator new(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) noexcept {
+        if (size <= Slab::kMaxSize) {
+            BlockCache::Deallocate(ptr);
+        } else {
+            ::operator delete(ptr, size);
+        }
+    }
+
+    // Over-aligned blocks do not fit the slots
+    static void* operator new(size_t size, std::align_val_t alignment) {
+        return ::operator new(size, alignment);
+    }
+
+    static void operator delete(void* ptr, size_t size, std::align_val_t alignment) noexcept {
+        ::operator delete(ptr, size, alignment);
+    }
+};
+
+// Standard allocator on top of `BlockCache`, for `AllocateShared`: control blocks are not cached
+// unless asked for, as the memory of the cache stays with the process. Requests the cache cannot
+// serve (too large or over-aligned) go to `operator new`
+template <typename T>
+class BlockCacheAllocator {
+public:
+    using value_type = T;
+
+    BlockCacheAllocator() noexcept = default;
+
+    template <typename U>
+    BlockCacheAllocator(const BlockCacheAllocator<U>&) noexcept {
+    }
+
+    T* allocate(size_t n) {
+        if (FromCache(n)) {
+            return static_cast<T*>(BlockCache::Allocate(n * sizeof(T)));
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        if (FromCache(n)) {
+            BlockCache::Deallocate(ptr);
+        } else {
+            std::allocator<T>().deallocate(ptr, n);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const BlockCacheAllocator<U>&) const noexcept {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const BlockCacheAllocator<U>&) const noexcept {
+        return false;
+    }
+
+private:
+    static bool FromCache(size_t n) noexcept {
+        return alignof(T) <= Slab::kGranularity && n <= Slab::kMaxSize / sizeof(T);
+    }
+};
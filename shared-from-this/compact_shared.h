@@ -0,0 +1,164 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+
+#include "shared.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+class BadCompactSharedPtr : public std::exception {};
+
+// `SharedPtr` to an object living inside its control block (made by `MakeShared`) in a single
+// word: the object is found at a fixed offset from the block, so there is no separate `ptr_`.
+// Moving from and to `SharedPtr` hands the reference over without touching the counters.
+template <typename T>
+class CompactSharedPtr {
+    static_assert(!std::is_array_v<T>, "Arrays are not supported");
+
+    template <typename Y>
+    friend class CompactSharedPtr;
+
+public:
+    using element_type = T;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    CompactSharedPtr() noexcept {
+    }
+
+    CompactSharedPtr(std::nullptr_t) noexcept {
+    }
+
+    // Throws `BadCompactSharedPtr` if `shared` points anywhere but at the object in its block:
+    // `SharedPtr(new T)`, aliasing, custom deleters and allocators, `MakeSharedPadded`
+    explicit CompactSharedPtr(SharedPtr<T>&& shared) {
+        if (shared.block_ != nullptr && (!ObjectBlock::IsKindOf(shared.block_) ||
+                                         shared.ptr_ != ObjectOf(shared.block_))) {
+            throw BadCompactSharedPtr();
+        }
+
+        block_ = shared.block_;
+        shared.block_ = nullptr;
+        shared.ptr_ = nullptr;
+    }
+
+    explicit CompactSharedPtr(const SharedPtr<T>& shared)
+        : CompactSharedPtr(SharedPtr<T>(shared)) {
+    }
+
+    CompactSharedPtr(const CompactSharedPtr& other) noexcept {
+        block_ = other.block_;
+
+        if (block_ != nullptr) {
+            block_->IncShared();
+        }
+    }
+
+    CompactSharedPtr(CompactSharedPtr&& other) noexcept {
+        Swap(other);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    CompactSharedPtr& operator=(const CompactSharedPtr& other) {
+        CompactSharedPtr(other).Swap(*this);
+        return *this;
+    }
+
+    CompactSharedPtr& operator=(CompactSharedPtr&& other) {
+        CompactSharedPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~CompactSharedPtr() {
+        if (block_ == nullptr) {
+            return;
+        }
+
+        if (block_->DecShared() == 0) {
+            block_->DestroyObject();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Conversion to `SharedPtr`
+
+    operator SharedPtr<T>() const& noexcept {
+        CompactSharedPtr copy(*this);
+        return copy;
+    }
+
+    operator SharedPtr<T>() && noexcept {
+        SharedPtr<T> shared;
+        shared.ptr_ = Get();
+        shared.block_ = std::exchange(block_, nullptr);
+        return shared;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() noexcept {
+        CompactSharedPtr().Swap(*this);
+    }
+
+    void Swap(CompactSharedPtr& other) noexcept {
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    T* Get() const noexcept {
+        return block_ == nullptr ? nullptr : ObjectOf(block_);
+    }
+
+    T& operator*() const noexcept {
+        return *ObjectOf(block_);
+    }
+
+    T* operator->() const noexcept {
+        return ObjectOf(block_);
+    }
+
+    size_t UseCount() const noexcept {
+        if (block_ == nullptr) {
+            return 0;
+        }
+
+        return block_->GetShared();
+    }
+
+    explicit operator bool() const noexcept {
+        return block_ != nullptr;
+    }
+
+private:
+    using Block = BlockFor<T>;
+    using ObjectBlock = ControlBlock2<std::remove_cv_t<T>>;
+
+    // `block` is always an `ObjectBlock`: the constructor checks its kind before keeping it
+    static T* ObjectOf(Block* block) noexcept {
+        return static_cast<ObjectBlock*>(block)->Get();
+    }
+
+    Block* block_ = nullptr;
+};
+
+template <typename T, typename U>
+inline bool operator==(const CompactSharedPtr<T>& left, const CompactSharedPtr<U>& right) {
+    return left.Get() == right.Get();
+}
+
+template <typename T, typename... Args>
+CompactSharedPtr<T> MakeCompactShared(Args&&... args) {
+    return CompactSharedPtr<T>(MakeShared<T>(std::forward<Args>(args)...));
+}
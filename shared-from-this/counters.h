@@ -0,0 +1,714 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <type_traits>
+
+// Reference counters of a control block.
+//
+// All strong references together own a single weak reference ("weak + 1"), so the block is freed
+// exactly once: by whoever drops the weak counter to zero. `DecShared()`/`DecWeak()` return the
+// number of references left, the caller must not touch the counter once it has hit zero.
+//
+// Once the strong count is zero and the weak count is one, that last weak reference is the
+// owners' and nobody else can reach the block any more. `IsLastWeak()` tells so with a load, which
+// spares the common "last strong reference, no `WeakPtr`" release the second decrement.
+//
+// `TryDropLastShared()` turns a strong count of one into zero and fails for any other count. The
+// caller then owns the object alone whatever `WeakPtr`s there are, since they can no longer lock
+// it, and calls `DestroyObject()` when done with it.
+//
+// `GetShared()` loads with acquire where it matters: the last owner that sees a count of one
+// may write to the object, after the reads done through the references that are gone. Where
+// `kExactUseCount` is false (the biased mode) the owner's part of the count is not synchronized,
+// and a count of one proves nothing to another thread.
+
+// Plain integers: a block (and all pointers to it) must stay within a single thread.
+class SimpleBlockCounters {
+public:
+    static constexpr bool kThreadSafe = false;
+    static constexpr bool kExactUseCount = true;
+
+    // Objects are always destroyed by the thread which releases the last reference
+    static void CollectDeferred() noexcept {
+    }
+
+    void IncShared() noexcept {
+        ++counter_shared_;
+    }
+
+    size_t DecShared() noexcept {
+        return --counter_shared_;
+    }
+
+    // Increment the strong counter unless the object is already dead (`WeakPtr::Lock`).
+    bool TryIncShared() noexcept {
+        if (counter_shared_ == 0) {
+            return false;
+        }
+
+        ++counter_shared_;
+        return true;
+    }
+
+    bool TryDropLastShared() noexcept {
+        if (counter_shared_ != 1) {
+            return false;
+        }
+
+        counter_shared_ = 0;
+        return true;
+    }
+
+    void IncWeak() noexcept {
+        ++counter_weak_;
+    }
+
+    size_t DecWeak() noexcept {
+        return --counter_weak_;
+    }
+
+    bool IsLastWeak() const noexcept {
+        return counter_weak_ == 1;
+    }
+
+    size_t GetShared() const noexcept {
+        return counter_shared_;
+    }
+
+    size_t GetWeak() const noexcept {
+        return counter_weak_ - (counter_shared_ != 0);
+    }
+
+private:
+    size_t counter_shared_ = 1;
+    size_t counter_weak_ = 1;
+};
+
+// Decrements are release, and the thread that drops a counter to zero issues an acquire fence
+// before destroying anything, so it sees every write done through the other references.
+// Returns the new value of the counter.
+template <typename Int>
+Int DecAtomicCounter(std::atomic<Int>& counter, Int one = 1, Int mask = ~Int{0}) noexcept {
+#ifdef __SANITIZE_THREAD__
+    // ThreadSanitizer does not understand standalone fences
+    return counter.fetch_sub(one, std::memory_order_acq_rel) - one;
+#else
+    Int left = counter.fetch_sub(one, std::memory_order_release) - one;
+    if ((left & mask) == 0) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return left;
+#endif
+}
+
+// Atomic counters: pointers to the same block may be copied and destroyed in different threads.
+// Increments are relaxed: a new reference can only be made from an existing one, so there is
+// nothing to publish.
+class AtomicBlockCounters {
+public:
+    static constexpr bool kThreadSafe = true;
+    static constexpr bool kExactUseCount = true;
+
+    static void CollectDeferred() noexcept {
+    }
+
+    void IncShared() noexcept {
+        counter_shared_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t DecShared() noexcept {
+        return DecAtomicCounter(counter_shared_);
+    }
+
+    bool TryIncShared() noexcept {
+        size_t count = counter_shared_.load(std::memory_order_relaxed);
+        while (count != 0) {
+            if (counter_shared_.compare_exchange_weak(count, count + 1,
+                                                      std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Acquire: the owners that are gone released their writes to the object
+    bool TryDropLastShared() noexcept {
+        size_t one = 1;
+        return counter_shared_.compare_exchange_strong(one, 0, std::memory_order_acquire,
+                                                       std::memory_order_relaxed);
+    }
+
+    void IncWeak() noexcept {
+        counter_weak_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t DecWeak() noexcept {
+        return DecAtomicCounter(counter_weak_);
+    }
+
+    // Acquire: pairs with the release decrements of the `WeakPtr`s that are gone
+    bool IsLastWeak() const noexcept {
+        return counter_weak_.load(std::memory_order_acquire) == 1;
+    }
+
+    size_t GetShared() const noexcept {
+        return counter_shared_.load(std::memory_order_acquire);
+    }
+
+    size_t GetWeak() const noexcept {
+        size_t shared = GetShared();
+        return counter_weak_.load(std::memory_order_relaxed) - (shared != 0);
+    }
+
+private:
+    std::atomic<size_t> counter_shared_ = 1;
+    std::atomic<size_t> counter_weak_ = 1;
+};
+
+// Both counters packed into one 64-bit word: strong in the low half, weak in the high half. Halves
+// the counters' size, and every update or query is one instruction on one word, so the two
+// counts are never seen out of sync. Overflowing either half terminates the program.
+template <bool Atomic>
+class PackedBlockCounters {
+public:
+    static constexpr bool kThreadSafe = Atomic;
+    static constexpr bool kExactUseCount = true;
+
+    static void CollectDeferred() noexcept {
+    }
+
+    void IncShared() noexcept {
+        CheckOverflow(Add(kOneShared));
+    }
+
+    // A sole owner with no `WeakPtr`s sees both counts at one in a single load, and has nobody
+    // to tell about the release: a plain store instead of a read-modify-write. The strong count
+    // still has to read zero while the object is destroyed, for `TryIncShared()` calls it makes
+    size_t DecShared() noexcept {
+        if (Load(std::memory_order_acquire) == (kOneShared | kOneWeak)) {
+            Store(kOneWeak);
+            return 0;
+        }
+        return Sub(kOneShared) & kSharedMask;
+    }
+
+    bool TryIncShared() noexcept {
+        if constexpr (Atomic) {
+            uint64_t word = word_.load(std::memory_order_relaxed);
+            do {
+                if ((word & kSharedMask) == 0) {
+                    return false;
+                }
+                CheckOverflow(word);
+            } while (!word_.compare_exchange_weak(word, word + kOneShared,
+                                                  std::memory_order_relaxed));
+            return true;
+        } else {
+            if ((word_ & kSharedMask) == 0) {
+                return false;
+            }
+            IncShared();
+            return true;
+        }
+    }
+
+    bool TryDropLastShared() noexcept {
+        if constexpr (Atomic) {
+            uint64_t word = word_.load(std::memory_order_relaxed);
+            do {
+                if ((word & kSharedMask) != 1) {
+                    return false;
+                }
+            } while (!word_.compare_exchange_weak(word, word - kOneShared,
+                                                  std::memory_order_acquire,
+                                                  std::memory_order_relaxed));
+            return true;
+        } else {
+            if ((word_ & kSharedMask) != 1) {
+                return false;
+            }
+            word_ -= kOneShared;
+            return true;
+        }
+    }
+
+    void IncWeak() noexcept {
+        CheckOverflow(Add(kOneWeak) >> kWeakShift);
+    }
+
+    size_t DecWeak() noexcept {
+        return Sub(kOneWeak) >> kWeakShift;
+    }
+
+    bool IsLastWeak() const noexcept {
+        return Load(std::memory_order_acquire) >> kWeakShift == 1;
+    }
+
+    size_t GetShared() const noexcept {
+        return Load(std::memory_order_acquire) & kSharedMask;
+    }
+
+    size_t GetWeak() const noexcept {
+        uint64_t word = Load();
+        return (word >> kWeakShift) - ((word & kSharedMask) != 0);
+    }
+
+private:
+    static constexpr int kWeakShift = 32;
+    static constexpr uint64_t kSharedMask = std::numeric_limits<uint32_t>::max();
+    static constexpr uint64_t kOneShared = 1;
+    static constexpr uint64_t kOneWeak = uint64_t{1} << kWeakShift;
+
+    // Takes the half which has just been incremented, as it was before the increment
+    static void CheckOverflow(uint64_t old) noexcept {
+        if ((old & kSharedMask) == kSharedMask) {
+            std::terminate();
+        }
+    }
+
+    // Return the value before the addition and after the subtraction
+    uint64_t Add(uint64_t one) noexcept {
+        if constexpr (Atomic) {
+            return word_.fetch_add(one, std::memory_order_relaxed);
+        } else {
+            uint64_t old = word_;
+            word_ += one;
+            return old;
+        }
+    }
+
+    uint64_t Sub(uint64_t one) noexcept {
+        if constexpr (Atomic) {
+            uint64_t mask = one == kOneShared ? kSharedMask : ~kSharedMask;
+            return DecAtomicCounter(word_, one, mask);
+        } else {
+            return word_ -= one;
+        }
+    }
+
+    uint64_t Load(std::memory_order order = std::memory_order_relaxed) const noexcept {
+        if constexpr (Atomic) {
+            return word_.load(order);
+        } else {
+            return word_;
+        }
+    }
+
+    void Store(uint64_t word) noexcept {
+        if constexpr (Atomic) {
+            word_.store(word, std::memory_order_relaxed);
+        } else {
+            word_ = word;
+        }
+    }
+
+    std::conditional_t<Atomic, std::atomic<uint64_t>, uint64_t> word_ = kOneShared | kOneWeak;
+};
+
+// The strong count alone, for blocks which never have `WeakPtr`s: atomic in every thread-safe
+// mode (the biased one included), a plain integer otherwise.
+// With no weak references the count cannot grow behind a sole owner's back, so a sole owner
+// releases with a load and no write.
+template <bool Atomic>
+class StrongBlockCounters {
+public:
+    static constexpr bool kThreadSafe = Atomic;
+    static constexpr bool kExactUseCount = true;
+
+    void IncShared() noexcept {
+        if constexpr (Atomic) {
+            counter_shared_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            ++counter_shared_;
+        }
+    }
+
+    size_t DecShared() noexcept {
+        if constexpr (Atomic) {
+            if (counter_shared_.load(std::memory_order_acquire) == 1) {
+                return 0;
+            }
+            return DecAtomicCounter(counter_shared_);
+        } else {
+            return --counter_shared_;
+        }
+    }
+
+    // Nobody else can change a count of one
+    bool TryDropLastShared() noexcept {
+        if constexpr (Atomic) {
+            if (counter_shared_.load(std::memory_order_acquire) != 1) {
+                return false;
+            }
+            counter_shared_.store(0, std::memory_order_relaxed);
+        } else {
+            if (counter_shared_ != 1) {
+                return false;
+            }
+            counter_shared_ = 0;
+        }
+        return true;
+    }
+
+    size_t GetShared() const noexcept {
+        if constexpr (Atomic) {
+            return counter_shared_.load(std::memory_order_acquire);
+        } else {
+            return counter_shared_;
+        }
+    }
+
+private:
+    std::conditional_t<Atomic, std::atomic<size_t>, size_t> counter_shared_ = 1;
+};
+
+template <typename Block>
+class BiasedBlockCounters;
+
+// Per-thread state of the biased mode. It identifies the owner of a block and collects the owned
+// blocks whose shared count went negative on other threads, so that the owner merges them.
+// Lives on the heap until the thread exits and every block it owns has been merged.
+template <typename Block>
+class BiasedOwner {
+public:
+    using Counters = BiasedBlockCounters<Block>;
+
+    // Null until the current thread creates its first block
+    static BiasedOwner* Current() noexcept {
+        return current;
+    }
+
+    static BiasedOwner* Attach() {
+        if (current == nullptr) {
+            static thread_local Detacher detacher;
+            current = new BiasedOwner();
+            detacher.owner = current;
+        }
+        return current;
+    }
+
+    void Ref() noexcept {
+        refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Unref() noexcept {
+        if (DecAtomicCounter(refs_) == 0) {
+            delete this;
+        }
+    }
+
+    // Called by other threads. Fails once the owner has exited.
+    bool Push(Counters* counters) noexcept {
+        Counters* head = queue_.load(std::memory_order_acquire);
+        do {
+            if (head == Closed()) {
+                return false;
+            }
+            counters->next_queued_ = head;
+        } while (!queue_.compare_exchange_weak(head, counters, std::memory_order_release,
+                                               std::memory_order_acquire));
+        return true;
+    }
+
+    // Called by the owner
+    void DrainIfNeeded() noexcept {
+        if (queue_.load(std::memory_order_relaxed) != nullptr) {
+            Drain(queue_.exchange(nullptr, std::memory_order_acquire));
+        }
+    }
+
+private:
+    struct Detacher {
+        ~Detacher() {
+            while (true) {
+                owner->DrainIfNeeded();
+                Counters* empty = nullptr;
+                if (owner->queue_.compare_exchange_strong(empty, Closed(),
+                                                          std::memory_order_acq_rel)) {
+                    break;
+                }
+            }
+            current = nullptr;
+            owner->Unref();
+        }
+
+        BiasedOwner* owner = nullptr;
+    };
+
+    static Counters* Closed() noexcept {
+        return reinterpret_cast<Counters*>(alignof(Counters));
+    }
+
+    static void Drain(Counters* counters) noexcept {
+        while (counters != nullptr) {
+            Counters* next = counters->next_queued_;
+            counters->MergeQueued();
+            counters = next;
+        }
+    }
+
+    static inline thread_local BiasedOwner* current = nullptr;
+
+    std::atomic<Counters*> queue_ = nullptr;
+    std::atomic<size_t> refs_ = 1;  // the thread itself and every unmerged block it owns
+};
+
+// Biased counters (Choi et al., "Biased Reference Counting", PACT'18): most blocks never leave the
+// thread that created them, so that thread counts its references in a plain integer, and only the
+// other threads pay for atomic instructions on a separate shared counter.
+//
+// The shared counter may go negative while the owner still holds references. The first thread to
+// drive it below zero queues the block to its owner, which merges both counters and from then on
+// the block is counted as with `AtomicBlockCounters`. The owner merges by itself once its own
+// count drops to zero. So an object whose last reference is dropped by another thread is only
+// destroyed when its owner gets to the queue (see `CollectDeferred()`), and until then a racing
+// `Lock()` may still bring it back.
+//
+// `Block` derives from these counters and provides `DestroyObject()`, which releases the last
+// strong reference found by a merge.
+template <typename Block>
+class BiasedBlockCounters {
+    friend class BiasedOwner<Block>;
+
+public:
+    static constexpr bool kThreadSafe = true;
+    static constexpr bool kExactUseCount = false;
+
+    // Merges the blocks queued to the current thread, destroying the objects that have no owners
+    // left. Happens anyway whenever this thread creates a block, locks a `WeakPtr` to a block it
+    // owns or exits.
+    static void CollectDeferred() noexcept {
+        if (Owner* owner = Owner::Current()) {
+            owner->DrainIfNeeded();
+        }
+    }
+
+    BiasedBlockCounters() noexcept {
+        Owner* owner = Owner::Attach();
+        owner->Ref();
+        owner_.store(owner, std::memory_order_relaxed);
+        owner->DrainIfNeeded();
+    }
+
+    void IncShared() noexcept {
+        if (IsOwner()) {
+            biased_.store(biased_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        } else {
+            shared_.fetch_add(kOne, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns zero only to the thread which has to destroy the object
+    size_t DecShared() noexcept {
+        if (IsOwner()) {
+            size_t biased = biased_.load(std::memory_order_relaxed);
+            if (biased > 1) {
+                biased_.store(biased - 1, std::memory_order_relaxed);
+                return biased - 1;
+            }
+            if (biased == 1) {
+                biased_.store(0, std::memory_order_relaxed);
+                return MergeByOwner();
+            }
+        }
+        return DecSharedRemote();
+    }
+
+    bool TryIncShared() noexcept {
+        if (IsOwner()) {
+            // The block may be waiting for a merge which would find it dead
+            Owner::Current()->DrainIfNeeded();
+            size_t biased = biased_.load(std::memory_order_relaxed);
+            if (IsOwner() && biased != 0) {
+                biased_.store(biased + 1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        int64_t word = shared_.load(std::memory_order_relaxed);
+        do {
+            if ((word & kMerged) && (word >> kFlagBits) == 0) {
+                return false;
+            }
+        } while (!shared_.compare_exchange_weak(word, word + kOne, std::memory_order_relaxed));
+        return true;
+    }
+
+    // Before a merge the owner's count can only change in the owner's thread, or through a
+    // `WeakPtr`: with neither of them around the block is merged here, as long as no other thread
+    // has taken or dropped a reference. So only an unmerged block of another thread which has
+    // `WeakPtr`s is never handed over
+    bool TryDropLastShared() noexcept {
+        if (!(shared_.load(std::memory_order_relaxed) & kMerged) &&
+            (IsOwner() || counter_weak_.load(std::memory_order_acquire) == 1)) {
+            int64_t untouched = 0;
+            if (biased_.load(std::memory_order_relaxed) != 1 ||
+                !shared_.compare_exchange_strong(untouched, kMerged, std::memory_order_acquire,
+                                                 std::memory_order_relaxed)) {
+                return false;
+            }
+            biased_.store(0, std::memory_order_relaxed);
+            owner_.exchange(nullptr, std::memory_order_relaxed)->Unref();
+            return true;
+        }
+
+        int64_t word = shared_.load(std::memory_order_relaxed);
+        do {
+            if (!(word & kMerged) || (word >> kFlagBits) != 1) {
+                return false;
+            }
+        } while (!shared_.compare_exchange_weak(word, word - kOne, std::memory_order_acquire,
+                                                std::memory_order_relaxed));
+        return true;
+    }
+
+    void IncWeak() noexcept {
+        counter_weak_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t DecWeak() noexcept {
+        return DecAtomicCounter(counter_weak_);
+    }
+
+    // Acquire: pairs with the release decrements of the `WeakPtr`s that are gone
+    bool IsLastWeak() const noexcept {
+        return counter_weak_.load(std::memory_order_acquire) == 1;
+    }
+
+    // Exact only when no other thread touches the block
+    size_t GetShared() const noexcept {
+        int64_t shared = shared_.load(std::memory_order_acquire) >> kFlagBits;
+        return static_cast<size_t>(static_cast<int64_t>(biased_.load(std::memory_order_relaxed)) +
+                                   shared);
+    }
+
+    size_t GetWeak() const noexcept {
+        size_t shared = GetShared();
+        return counter_weak_.load(std::memory_order_relaxed) - (shared != 0);
+    }
+
+private:
+    using Owner = BiasedOwner<Block>;
+
+    // `shared_` keeps a signed count above two flag bits
+    static constexpr int64_t kMerged = 1;
+    static constexpr int64_t kQueued = 2;
+    static constexpr int kFlagBits = 2;
+    static constexpr int64_t kOne = int64_t{1} << kFlagBits;
+
+    bool IsOwner() const noexcept {
+        Owner* owner = owner_.load(std::memory_order_relaxed);
+        return owner != nullptr && owner == Owner::Current();
+    }
+
+    // Once the block is marked as merged, another thread may drop the last reference and free
+    // it: the owner is detached before that, and nothing in the block is touched after
+    size_t MergeByOwner() noexcept {
+        Owner* owner = owner_.exchange(nullptr, std::memory_order_relaxed);
+        int64_t word = shared_.load(std::memory_order_relaxed);
+        do {
+            if (word & kQueued) {
+                // Another thread has queued the block: merge it through the queue. Until then
+                // the block cannot go away, as only a merge finds the count at zero
+                owner_.store(owner, std::memory_order_relaxed);
+                owner->DrainIfNeeded();
+                return 1;
+            }
+        } while (!shared_.compare_exchange_weak(word, word | kMerged, std::memory_order_acq_rel,
+                                                std::memory_order_relaxed));
+
+        owner->Unref();
+        return static_cast<size_t>(word >> kFlagBits);
+    }
+
+    size_t DecSharedRemote() noexcept {
+        // Loaded up front: the owner briefly detaches itself while merging. It does so only once
+        // its own count is zero, and then this decrement cannot make the count negative
+        Owner* owner = owner_.load(std::memory_order_relaxed);
+        int64_t word = shared_.load(std::memory_order_relaxed);
+        int64_t next;
+        do {
+            next = word - kOne;
+            if (!(word & (kMerged | kQueued)) && (next >> kFlagBits) < 0) {
+                next |= kQueued;
+            }
+        } while (!shared_.compare_exchange_weak(word, next, std::memory_order_acq_rel,
+                                                std::memory_order_relaxed));
+
+        if (next & kMerged) {
+            return static_cast<size_t>(next >> kFlagBits);
+        }
+
+        if ((next & kQueued) && !(word & kQueued) && !owner->Push(this)) {
+            // The owner has exited and will never touch its count again
+            MergeQueued();
+        }
+        return 1;
+    }
+
+    // Folds the owner's count into the shared one
+    void MergeQueued() noexcept {
+        auto biased = static_cast<int64_t>(biased_.load(std::memory_order_relaxed));
+        biased_.store(0, std::memory_order_relaxed);
+        Owner* owner = owner_.exchange(nullptr, std::memory_order_relaxed);
+
+        int64_t word = shared_.fetch_add(biased * kOne + kMerged, std::memory_order_acq_rel);
+        owner->Unref();
+        if ((word >> kFlagBits) + biased == 0) {
+            static_cast<Block*>(this)->DestroyObject();
+        }
+    }
+
+    std::atomic<Owner*> owner_ = nullptr;
+    std::atomic<size_t> biased_ = 1;  // only the owner writes it
+    std::atomic<int64_t> shared_ = 0;
+    std::atomic<size_t> counter_weak_ = 1;
+    BiasedBlockCounters* next_queued_ = nullptr;
+};
+
+// Counts the updates of `Counters` on top of them, for single-threaded tests of the paths that
+// must not touch the counters at all (`SW_COUNTING_COUNTERS`)
+template <typename Counters>
+class CountingBlockCounters : public Counters {
+public:
+    static_assert(!Counters::kThreadSafe, "The counts are plain integers");
+
+    void IncShared() noexcept {
+        ++increments;
+        Counters::IncShared();
+    }
+
+    size_t DecShared() noexcept {
+        ++decrements;
+        return Counters::DecShared();
+    }
+
+    bool TryIncShared() noexcept {
+        bool incremented = Counters::TryIncShared();
+        increments += incremented;
+        return incremented;
+    }
+
+    bool TryDropLastShared() noexcept {
+        bool dropped = Counters::TryDropLastShared();
+        decrements += dropped;
+        return dropped;
+    }
+
+    void IncWeak() noexcept {
+        ++increments;
+        Counters::IncWeak();
+    }
+
+    size_t DecWeak() noexcept {
+        ++decrements;
+        return Counters::DecWeak();
+    }
+
+    static inline size_t increments = 0;
+    static inline size_t decrements = 0;
+};
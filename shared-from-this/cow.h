@@ -0,0 +1,91 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+
+#include "shared.h"
+
+#include <cstddef>  // std::nullptr_t
+#include <type_traits>
+#include <utility>
+
+// Copy-on-write value: copies share the object, and `Write()` gives the writer an object of its
+// own, cloning it first if any other copy still refers to it. Copies may live in different threads
+// with the atomic counters; a single `CowPtr` is not synchronized, as with `SharedPtr`. The biased
+// counters cannot tell a sole owner in another thread that the owner thread is done with the
+// object, so there `CowPtr` is only available for strong-only types.
+//
+// The object is never reachable through a `WeakPtr`, so nothing can raise a use count of one
+// behind the writer's back.
+template <typename T>
+class CowPtr {
+    static_assert(!std::is_array_v<T>, "Arrays are not supported");
+    static_assert(!std::is_convertible_v<T*, ESFTBase*>,
+                  "EnableSharedFromThis would hand out references past the uniqueness check");
+    static_assert(BlockFor<T>::kExactUseCount,
+                  "The use count is not synchronized with these counters (biased mode)");
+
+public:
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    CowPtr() noexcept {
+    }
+
+    CowPtr(std::nullptr_t) noexcept {
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() noexcept {
+        shared_.Reset();
+    }
+
+    void Swap(CowPtr& other) noexcept {
+        shared_.Swap(other.shared_);
+    }
+
+    // Must not be empty. The reference is valid until this pointer is copied to or changed
+    T& Write() {
+        if (shared_.UseCount() != 1) {
+            shared_ = MakeShared<T>(std::as_const(*shared_));
+        }
+        return *shared_;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    const T& Read() const noexcept {
+        return *shared_;
+    }
+
+    const T& operator*() const noexcept {
+        return *shared_;
+    }
+
+    const T* operator->() const noexcept {
+        return shared_.Get();
+    }
+
+    size_t UseCount() const noexcept {
+        return shared_.UseCount();
+    }
+
+    explicit operator bool() const noexcept {
+        return static_cast<bool>(shared_);
+    }
+
+    template <typename T_, typename... Args>
+    friend CowPtr<T_> MakeCow(Args&&... args);
+
+private:
+    SharedPtr<T> shared_;
+};
+
+template <typename T, typename... Args>
+CowPtr<T> MakeCow(Args&&... args) {
+    CowPtr<T> cow;
+    cow.shared_ = MakeShared<T>(std::forward<Args>(args)...);
+    return cow;
+}
@@ -2,10 +2,15 @@
 
 #include "sw_fwd.h"  // Forward declaration
 
+#include "../unique/unique.h"
+
 #include <cstddef>  // std::nullptr_t
 #include <type_traits>
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
+//
+// `T` may be an array type (`U[]` or `U[N]`): the pointer then refers to the first element,
+// which is released with `delete[]`
 template <typename T>
 class SharedPtr {
     template <typename Y>
@@ -19,7 +24,21 @@ class SharedPtr {
     template <typename Y>
     friend class EnableSharedFromThis;
 
+    template <typename Y>
+    friend class EmbeddedSharedFromThis;
+
+    template <typename Y>
+    friend class AtomicSharedPtr;
+
+    template <typename Y>
+    friend class CompactSharedPtr;
+
+    template <typename Y>
+    friend class ThinWeakPtr;
+
 public:
+    using element_type = std::remove_extent_t<T>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -29,46 +48,90 @@ public:
     SharedPtr(std::nullptr_t) noexcept {
     }
 
-    explicit SharedPtr(T* ptr) noexcept {
-        block_ = new ControlBlock1<T>(ptr);
-        block_->IncShared();
+    explicit SharedPtr(element_type* ptr) noexcept {
+        block_ = NewBlock(ptr);
         ptr_ = ptr;
 
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            ptr_->weak_this_ = *this;
-        }
+        HookSharedFromThis(ptr);
     }
 
     template <typename Y>
     explicit SharedPtr(Y* ptr) noexcept {
-        block_ = new ControlBlock1<Y>(ptr);
-        block_->IncShared();
+        block_ = NewBlock(ptr);
         ptr_ = ptr;
 
-        if constexpr (std::is_convertible_v<Y*, ESFTBase*>) {
-            ptr_->weak_this_ = *this;
+        HookSharedFromThis(ptr);
+    }
+
+    // The deleter is called on `ptr` if the control block cannot be allocated
+    template <typename Y, typename Deleter>
+    SharedPtr(Y* ptr, Deleter deleter) {
+        try {
+            block_ = new ControlBlockDeleter<Y, Deleter>(ptr, std::move(deleter));
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+        ptr_ = ptr;
+
+        HookSharedFromThis(ptr);
+    }
+
+    // Same with the control block allocated by `alloc`
+    template <typename Y, typename Deleter, typename Alloc>
+    SharedPtr(Y* ptr, Deleter deleter, Alloc alloc) {
+        try {
+            block_ = ControlBlockDeleterAlloc<Y, Deleter, Alloc>::Create(ptr, std::move(deleter),
+                                                                         alloc);
+        } catch (...) {
+            deleter(ptr);
+            throw;
         }
+        ptr_ = ptr;
+
+        HookSharedFromThis(ptr);
+    }
+
+    // Takes over the object and the deleter of `unique`, which is left untouched if the control
+    // block cannot be allocated
+    template <typename Y, typename Deleter>
+    SharedPtr(UniquePtr<Y, Deleter>&& unique) {
+        using Element = std::remove_extent_t<Y>;
+        if (unique.Get() == nullptr) {
+            return;
+        }
+
+        block_ = new ControlBlockDeleter<Element, Deleter>(unique.Get(),
+                                                           std::move(unique.GetDeleter()));
+        ptr_ = unique.Release();
+
+        HookSharedFromThis(ptr_);
+    }
+
+    // Made by `MakeShareableUnique`: the block is already there, nothing is allocated
+    template <typename Y>
+    SharedPtr(UniquePtr<Y, ShareableDelete>&& unique) noexcept {
+        if (unique.Get() == nullptr) {
+            return;
+        }
+
+        block_ = unique.GetDeleter().block_;
+        ptr_ = unique.Release();
+
+        HookSharedFromThis(ptr_);
     }
 
     SharedPtr(const SharedPtr& other) noexcept {
         block_ = other.block_;
         ptr_ = other.ptr_;
 
-        if (*this) {
+        if (block_ != nullptr) {
             block_->IncShared();
         }
-
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            ptr_->weak_this_ = *this;
-        }
     }
 
     SharedPtr(SharedPtr&& other) noexcept {
         Swap(other);
-
-        if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-            ptr_->weak_this_ = *this;
-        }
     }
 
     template <class Y>
@@ -76,13 +139,9 @@ public:
         ptr_ = other.ptr_;
         block_ = other.block_;
 
-        if (*this) {
+        if (block_ != nullptr) {
             block_->IncShared();
         }
-
-        if constexpr (std::is_convertible_v<Y*, ESFTBase*>) {
-            ptr_->weak_this_ = *this;
-        }
     }
 
     template <class Y>
@@ -91,37 +150,38 @@ public:
         block_ = other.block_;
         other.ptr_ = nullptr;
         other.block_ = nullptr;
-
-        if constexpr (std::is_convertible_v<Y*, ESFTBase*>) {
-            ptr_->weak_this_ = *this;
-        }
     }
 
     // Aliasing constructor
     // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) noexcept {
+    SharedPtr(const SharedPtr<Y>& other, element_type* ptr) noexcept {
         ptr_ = ptr;
         block_ = other.block_;
 
-        if (*this) {
+        if (block_ != nullptr) {
             block_->IncShared();
         }
     }
 
+    // Takes the reference of `other` over, so the counters are not touched
+    template <typename Y>
+    SharedPtr(SharedPtr<Y>&& other, element_type* ptr) noexcept {
+        ptr_ = ptr;
+        block_ = other.block_;
+        other.ptr_ = nullptr;
+        other.block_ = nullptr;
+    }
+
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.Expired()) {
+        if (other.block_ == nullptr || !other.block_->TryIncShared()) {
             throw BadWeakPtr();
         }
 
         ptr_ = other.ptr_;
         block_ = other.block_;
-
-        if (block_ != nullptr) {
-            block_->IncShared();
-        }
     }
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
@@ -153,18 +213,12 @@ public:
     // Destructor
 
     ~SharedPtr() {
-        if (!*this) {
+        if (block_ == nullptr) {
             return;
         }
 
-        block_->DecShared();
-        if (block_->GetShared() == 0) {
-            if (block_->GetWeak() == 0) {
-                block_->ObjectDestructor();
-                delete block_;
-            } else {
-                block_->ObjectDestructor();
-            }
+        if (block_->DecShared() == 0) {
+            block_->DestroyObject();
         }
     }
 
@@ -175,7 +229,7 @@ public:
         SharedPtr<T>().Swap(*this);
     }
 
-    void Reset(T* ptr) noexcept {
+    void Reset(element_type* ptr) noexcept {
         SharedPtr<T>(ptr).Swap(*this);
     }
 
@@ -184,6 +238,16 @@ public:
         SharedPtr<T>(ptr).Swap(*this);
     }
 
+    template <typename Y, typename Deleter>
+    void Reset(Y* ptr, Deleter deleter) {
+        SharedPtr<T>(ptr, std::move(deleter)).Swap(*this);
+    }
+
+    template <typename Y, typename Deleter, typename Alloc>
+    void Reset(Y* ptr, Deleter deleter, Alloc alloc) {
+        SharedPtr<T>(ptr, std::move(deleter), std::move(alloc)).Swap(*this);
+    }
+
     void Swap(SharedPtr& other) noexcept {
         std::swap(block_, other.block_);
         std::swap(ptr_, other.ptr_);
@@ -192,20 +256,26 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const noexcept {
+    element_type* Get() const noexcept {
         return ptr_;
     }
 
-    T& operator*() const noexcept {
+    element_type& operator*() const noexcept {
         return *Get();
     }
 
-    T* operator->() const noexcept {
+    element_type* operator->() const noexcept {
         return Get();
     }
 
+    // For arrays only
+    element_type& operator[](std::ptrdiff_t i) const noexcept {
+        static_assert(std::is_array_v<T>);
+        return Get()[i];
+    }
+
     size_t UseCount() const noexcept {
-        if (!*this) {
+        if (block_ == nullptr) {
             return 0;
         }
 
@@ -219,9 +289,56 @@ public:
     template <typename _T, typename... Args>
     friend SharedPtr<_T> MakeShared(Args&&... args);
 
+    template <typename _T, typename... Args>
+    friend SharedPtr<_T> MakeSharedPadded(Args&&... args);
+
+    template <typename _T, typename... Args>
+    friend SharedPtr<_T> MakeSharedSplit(Args&&... args);
+
+    template <typename _T, typename Alloc, typename... Args>
+    friend SharedPtr<_T> AllocateShared(const Alloc& alloc, Args&&... args);
+
+    template <typename Deleter, typename Y>
+    friend Deleter* GetDeleter(const SharedPtr<Y>& shared) noexcept;
+
+    template <typename Y>
+    friend UniquePtr<Y, UnwrappedDelete<BlockFor<Y>>> TryUnwrap(SharedPtr<Y>&& shared) noexcept;
+
 private:
-    BaseBlock* block_ = nullptr;
-    T* ptr_ = nullptr;
+    using Block = BlockFor<T>;
+
+    template <typename Y>
+    static Block* NewBlock(Y* ptr) {
+        if constexpr (std::is_array_v<T>) {
+            return new ControlBlockDeleter<Y, std::default_delete<Y[]>>(ptr, {});
+        } else if constexpr (std::is_convertible_v<std::remove_cv_t<Y>*, EmbeddedESFTBase*>) {
+            // A null pointer has no header: it gets a block of its own like any other type
+            if (ptr != nullptr) {
+                return ControlBlockEmbedded<Y>::Create(ptr);
+            }
+        }
+        return new ControlBlock1<Y>(ptr);
+    }
+
+    // Called where the object gets its first owner, so that it can find its owners later on
+    template <typename Y>
+    void HookSharedFromThis(Y* ptr) noexcept {
+        if constexpr (std::is_array_v<T>) {
+            return;
+        } else if (ptr == nullptr) {
+            return;
+        } else if constexpr (std::is_convertible_v<std::remove_cv_t<Y>*, EmbeddedESFTBase*>) {
+            static_assert(std::is_same_v<BlockFor<Y>, BaseBlock>,
+                          "EmbeddedSharedFromThis is not supported for strong-only types");
+            auto base = static_cast<const EmbeddedESFTBase*>(ptr);
+            const_cast<EmbeddedESFTBase*>(base)->block_ = block_;
+        } else if constexpr (std::is_convertible_v<Y*, ESFTBase*>) {
+            ptr_->weak_this_ = *this;
+        }
+    }
+
+    Block* block_ = nullptr;
+    element_type* ptr_ = nullptr;
 };
 
 template <typename T, typename U>
@@ -229,22 +346,201 @@ inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
     return left.Get() == right.Get();
 }
 
-// Allocate memory only once
+// Allocate memory only once.
+// For `T[]` the arguments are the element count and optionally a value to copy into every
+// element; for `T[N]` just the optional value
 template <typename T, typename... Args>
 SharedPtr<T> MakeShared(Args&&... args) {
     SharedPtr<T> shared;
-    auto block = new ControlBlock2<T>(std::forward<Args>(args)...);
+    ControlBlock2<T>* block;
+    if constexpr (std::is_array_v<T> && std::extent_v<T> == 0) {
+        block = ControlBlock2<T>::Create(std::forward<Args>(args)...);
+    } else {
+        block = new ControlBlock2<T>(std::forward<Args>(args)...);
+    }
+    shared.block_ = block;
+    shared.ptr_ = block->Get();
+
+    shared.HookSharedFromThis(shared.ptr_);
+
+    return shared;
+}
+
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/make_shared
+// Default-initialize instead of value-initialize: large trivial buffers are not zeroed
+template <typename T>
+SharedPtr<T> MakeSharedForOverwrite() {
+    static_assert(!std::is_array_v<T> || std::extent_v<T> != 0, "Pass the element count");
+    return MakeShared<T>(ForOverwriteTag());
+}
+
+template <typename T>
+SharedPtr<T> MakeSharedForOverwrite(size_t count) {
+    static_assert(std::is_array_v<T> && std::extent_v<T> == 0, "Only for T[]");
+    return MakeShared<T>(count, ForOverwriteTag());
+}
+
+// Like `MakeShared`, but the object starts on a new cache line after the counters. Costs up to a
+// line of memory per object, pays off for objects written by one thread while other threads copy
+// and drop pointers to them
+template <typename T, typename... Args>
+SharedPtr<T> MakeSharedPadded(Args&&... args) {
+    static_assert(!std::is_array_v<T>, "Not supported for arrays");
+
+    SharedPtr<T> shared;
+    auto block = new ControlBlock2<T, true>(std::forward<Args>(args)...);
     shared.block_ = block;
-    shared.block_->IncShared();
     shared.ptr_ = block->Get();
 
-    if constexpr (std::is_convertible_v<T*, ESFTBase*>) {
-        shared.ptr_->weak_this_ = shared;
+    shared.HookSharedFromThis(shared.ptr_);
+
+    return shared;
+}
+
+// Two allocations instead of one: the object is freed as soon as the last `SharedPtr` is gone,
+// while only the small control block waits for the `WeakPtr`s. Meant for large objects, which
+// `MakeShared` would keep in memory for as long as any `WeakPtr` to them exists.
+// For `T[]` the argument is the element count, elements are value-initialized
+template <typename T, typename... Args>
+SharedPtr<T> MakeSharedSplit(Args&&... args) {
+    static_assert(!std::is_array_v<T> || std::extent_v<T> == 0, "Use T[] for arrays");
+
+    SharedPtr<T> shared;
+    if constexpr (std::is_array_v<T>) {
+        static_assert(sizeof...(Args) == 1, "Pass the element count");
+        using Element = std::remove_extent_t<T>;
+        const size_t count = (static_cast<size_t>(args), ...);
+        auto elements = new Element[count]();
+        try {
+            shared.block_ = new ControlBlockDeleter<Element, std::default_delete<Element[]>>(
+                elements, {});
+        } catch (...) {
+            delete[] elements;
+            throw;
+        }
+        shared.ptr_ = elements;
+    } else {
+        auto object = new T(std::forward<Args>(args)...);
+        try {
+            shared.block_ = new ControlBlock1<T>(object);
+        } catch (...) {
+            delete object;
+            throw;
+        }
+        shared.ptr_ = object;
+
+        shared.HookSharedFromThis(shared.ptr_);
     }
 
     return shared;
 }
 
+// Like `MakeShared`, but the single allocation comes from `alloc`
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/allocate_shared
+template <typename T, typename Alloc, typename... Args>
+SharedPtr<T> AllocateShared(const Alloc& alloc, Args&&... args) {
+    SharedPtr<T> shared;
+    auto block = ControlBlockAlloc<T, Alloc>::Create(alloc, std::forward<Args>(args)...);
+    shared.block_ = block;
+    shared.ptr_ = block->Get();
+
+    shared.HookSharedFromThis(shared.ptr_);
+
+    return shared;
+}
+
+// Unique ownership with the control block allocated up front, next to the object as in
+// `MakeShared`: moving the result into a `SharedPtr` allocates nothing. The pointer must not be
+// `Reset` to another object
+template <typename T, typename... Args>
+UniquePtr<T, ShareableDelete> MakeShareableUnique(Args&&... args) {
+    static_assert(!std::is_array_v<T>, "Not supported for arrays");
+    static_assert(!kStrongOnly<std::remove_cv_t<T>>, "Not supported for strong-only types");
+
+    auto block = new ControlBlock2<T>(std::forward<Args>(args)...);
+    return UniquePtr<T, ShareableDelete>(block->Get(), ShareableDelete(block));
+}
+
+// Rust's `Arc::try_unwrap`: if `shared` is the only `SharedPtr` to its object, the object is
+// handed over in place, with no copy or move, and `WeakPtr`s to it expire. Otherwise the result
+// is empty and `shared` is left as it was. In the biased mode this also fails for an object that
+// another thread created and that has `WeakPtr`s
+template <typename T>
+UniquePtr<T, UnwrappedDelete<BlockFor<T>>> TryUnwrap(SharedPtr<T>&& shared) noexcept {
+    using Unwrapped = UniquePtr<T, UnwrappedDelete<BlockFor<T>>>;
+    if (shared.block_ == nullptr || !shared.block_->TryDropLastShared()) {
+        return Unwrapped();
+    }
+
+    Unwrapped unique(shared.ptr_, UnwrappedDelete(shared.block_));
+    shared.block_ = nullptr;
+    shared.ptr_ = nullptr;
+    return unique;
+}
+
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/get_deleter
+template <typename Deleter, typename T>
+Deleter* GetDeleter(const SharedPtr<T>& shared) noexcept {
+    if (shared.block_ == nullptr) {
+        return nullptr;
+    }
+
+    return static_cast<Deleter*>(shared.block_->GetDeleter(&kTypeTag<Deleter>));
+}
+
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/pointer_cast
+// The rvalue overloads move the reference into the result instead of copying it
+template <typename T, typename U>
+SharedPtr<T> StaticPointerCast(const SharedPtr<U>& shared) noexcept {
+    return SharedPtr<T>(shared, static_cast<typename SharedPtr<T>::element_type*>(shared.Get()));
+}
+
+template <typename T, typename U>
+SharedPtr<T> StaticPointerCast(SharedPtr<U>&& shared) noexcept {
+    auto ptr = static_cast<typename SharedPtr<T>::element_type*>(shared.Get());
+    return SharedPtr<T>(std::move(shared), ptr);
+}
+
+// Returns an empty pointer if the cast fails, leaving `shared` as it was
+template <typename T, typename U>
+SharedPtr<T> DynamicPointerCast(const SharedPtr<U>& shared) noexcept {
+    if (auto ptr = dynamic_cast<typename SharedPtr<T>::element_type*>(shared.Get())) {
+        return SharedPtr<T>(shared, ptr);
+    }
+    return SharedPtr<T>();
+}
+
+template <typename T, typename U>
+SharedPtr<T> DynamicPointerCast(SharedPtr<U>&& shared) noexcept {
+    if (auto ptr = dynamic_cast<typename SharedPtr<T>::element_type*>(shared.Get())) {
+        return SharedPtr<T>(std::move(shared), ptr);
+    }
+    return SharedPtr<T>();
+}
+
+template <typename T, typename U>
+SharedPtr<T> ConstPointerCast(const SharedPtr<U>& shared) noexcept {
+    return SharedPtr<T>(shared, const_cast<typename SharedPtr<T>::element_type*>(shared.Get()));
+}
+
+template <typename T, typename U>
+SharedPtr<T> ConstPointerCast(SharedPtr<U>&& shared) noexcept {
+    auto ptr = const_cast<typename SharedPtr<T>::element_type*>(shared.Get());
+    return SharedPtr<T>(std::move(shared), ptr);
+}
+
+template <typename T, typename U>
+SharedPtr<T> ReinterpretPointerCast(const SharedPtr<U>& shared) noexcept {
+    return SharedPtr<T>(shared,
+                        reinterpret_cast<typename SharedPtr<T>::element_type*>(shared.Get()));
+}
+
+template <typename T, typename U>
+SharedPtr<T> ReinterpretPointerCast(SharedPtr<U>&& shared) noexcept {
+    auto ptr = reinterpret_cast<typename SharedPtr<T>::element_type*>(shared.Get());
+    return SharedPtr<T>(std::move(shared), ptr);
+}
+
 // Look for usage examples in tests
 template <typename T>
 class EnableSharedFromThis : public ESFTBase {
@@ -267,3 +563,48 @@ public:
 
     WeakPtr<T> weak_this_;
 };
+
+// `EnableSharedFromThis` with the counters in the same allocation as the object, also for
+// `SharedPtr(new T)`. The object keeps a plain pointer to its block instead of a `WeakPtr`, so
+// taking the object over touches no counters besides the new block's own
+template <typename T>
+class EmbeddedSharedFromThis : public EmbeddedESFTBase {
+public:
+    SharedPtr<T> SharedFromThis() {
+        SharedPtr<T> shared;
+        if (block_ != nullptr && block_->TryIncShared()) {
+            shared.block_ = block_;
+            shared.ptr_ = static_cast<T*>(this);
+        }
+        return shared;
+    }
+
+    SharedPtr<const T> SharedFromThis() const {
+        SharedPtr<const T> shared;
+        if (block_ != nullptr && block_->TryIncShared()) {
+            shared.block_ = block_;
+            shared.ptr_ = static_cast<const T*>(this);
+        }
+        return shared;
+    }
+
+    WeakPtr<T> WeakFromThis() noexcept {
+        WeakPtr<T> weak;
+        if (block_ != nullptr) {
+            block_->IncWeak();
+            weak.block_ = block_;
+            weak.ptr_ = static_cast<T*>(this);
+        }
+        return weak;
+    }
+
+    WeakPtr<const T> WeakFromThis() const noexcept {
+        WeakPtr<const T> weak;
+        if (block_ != nullptr) {
+            block_->IncWeak();
+            weak.block_ = block_;
+            weak.ptr_ = static_cast<const T*>(this);
+        }
+        return weak;
+    }
+};
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Memory for small control blocks.
+//
+// Sizes are rounded up to a multiple of `kGranularity`, and every such size class keeps a free
+// list per thread and a shared one. Most allocations and deallocations are a pop or a push on the
+// list of the current thread, with no lock and no atomic instruction. Slots move between a thread
+// and the shared list `kBatchSize` at a time under a spin lock: the thread takes a batch when its
+// list is empty and gives one back when its list grows too long, or gives everything back when it
+// exits. An empty shared list is refilled with a run of slots cut out of a large chunk (backed by
+// a huge page where the system allows it).
+//
+// Chunks are never returned to the system: the slab only grows up to the peak number of live
+// blocks, so it is meant for control blocks of hot paths and is used only where asked for.
+class Slab {
+public:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxSize = 256;
+    static constexpr size_t kNumClasses = kMaxSize / kGranularity;
+    static constexpr size_t kChunkSize = size_t{2} << 20;
+    static constexpr size_t kRunSize = size_t{16} << 10;
+    static constexpr size_t kBatchSize = 32;
+
+    // Counts of other threads are added up whenever they move a batch, and when they exit
+    struct Stats {
+        size_t allocations = 0;
+        size_t deallocations = 0;
+        size_t refills = 0;
+        size_t chunks = 0;
+
+        size_t InUse() const noexcept {
+            return allocations - deallocations;
+        }
+    };
+
+    // `size` must not exceed `kMaxSize`. Slots are aligned to `kGranularity`
+    static void* Allocate(size_t size) {
+        size_t index = ClassOf(size);
+        LocalList& list = local_lists[index];
+        if (list.free == nullptr) {
+            if (!Attach()) {
+                return AllocateShared(index);
+            }
+            Fetch(index, list);
+        }
+        Slot* slot = list.free;
+        list.free = slot->next;
+        --list.length;
+        ++list.allocations;
+        return slot;
+    }
+
+    static void Deallocate(void* ptr, size_t size) noexcept {
+        auto slot = static_cast<Slot*>(ptr);
+        size_t index = ClassOf(size);
+        if (!Attach()) {
+            DeallocateShared(index, slot);
+            return;
+        }
+        LocalList& list = local_lists[index];
+        slot->next = list.free;
+        list.free = slot;
+        ++list.length;
+        ++list.deallocations;
+        if (list.length >= 2 * kBatchSize) {
+            Release(index, list, kBatchSize);
+        }
+    }
+
+    static size_t ClassOf(size_t size) noexcept {
+        return size == 0 ? 0 : (size - 1) / kGranularity;
+    }
+
+    static size_t SlotSize(size_t size) noexcept {
+        return (ClassOf(size) + 1) * kGranularity;
+    }
+
+    // `kRunSize` bytes aligned to `kRunSize`, for callers that manage slots by themselves
+    static void* AllocateRun() {
+        LockGuard guard(chunk_lock);
+        if (chunk_left == 0) {
+            chunk_begin = NewChunk();
+            chunk_left = kChunkSize;
+        }
+        char* run = chunk_begin;
+        chunk_begin += kRunSize;
+        chunk_left -= kRunSize;
+        return run;
+    }
+
+    // Totals over all size classes, or over the class that `size` belongs to
+    static Stats GetStats() noexcept {
+        Stats stats;
+        for (size_t size = kGranularity; size <= kMaxSize; size += kGranularity) {
+            Stats of_class = GetStats(size);
+            stats.allocations += of_class.allocations;
+            stats.deallocations += of_class.deallocations;
+            stats.refills += of_class.refills;
+        }
+        stats.chunks = chunks.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    static Stats GetStats(size_t size) noexcept {
+        const SizeClass& size_class = classes[ClassOf(size)];
+        const LocalList& list = local_lists[ClassOf(size)];
+        Stats stats;
+        stats.allocations = size_class.allocations.load(std::memory_order_relaxed) +
+                            list.allocations;
+        stats.deallocations = size_class.deallocations.load(std::memory_order_relaxed) +
+                              list.deallocations;
+        stats.refills = size_class.refills.load(std::memory_order_relaxed);
+        stats.chunks = chunks.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    struct Slot {
+        Slot* next;
+    };
+
+    class LockGuard {
+    public:
+        explicit LockGuard(std::atomic_flag& lock) noexcept : lock_(lock) {
+            while (lock_.test_and_set(std::memory_order_acquire)) {
+            }
+        }
+
+        ~LockGuard() {
+            lock_.clear(std::memory_order_release);
+        }
+
+    private:
+        std::atomic_flag& lock_;
+    };
+
+    // Statistics are written under the class lock, and atomic only to be read without it
+    struct SizeClass {
+        std::atomic_flag lock = ATOMIC_FLAG_INIT;
+        Slot* free = nullptr;
+        std::atomic<size_t> allocations = 0;
+        std::atomic<size_t> deallocations = 0;
+        std::atomic<size_t> refills = 0;
+    };
+
+    // Trivially destructible, so that it is still there for the destructors of other
+    // thread-locals after the thread has given its slots back
+    struct LocalList {
+        Slot* free = nullptr;
+        size_t length = 0;
+        size_t allocations = 0;  // not yet added to the shared statistics
+        size_t deallocations = 0;
+    };
+
+    enum class ThreadState { kNew, kAttached, kExited };
+
+    struct Detacher {
+        ~Detacher() {
+            for (size_t index = 0; index < kNumClasses; ++index) {
+                Release(index, local_lists[index], local_lists[index].length);
+            }
+            state = ThreadState::kExited;
+        }
+    };
+
+    // Registers the return of the slots at thread exit before the thread gets any. Fails once
+    // the thread has exited: the shared lists serve it from then on
+    static bool Attach() noexcept {
+        if (state == ThreadState::kAttached) {
+            return true;
+        }
+        if (state == ThreadState::kExited) {
+            return false;
+        }
+        static thread_local Detacher detacher;
+        state = ThreadState::kAttached;
+        return true;
+    }
+
+    static void Add(std::atomic<size_t>& counter, size_t value) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // Called with the class lock held
+    static void AddStats(SizeClass& size_class, LocalList& list) noexcept {
+        Add(size_class.allocations, std::exchange(list.allocations, 0));
+        Add(size_class.deallocations, std::exchange(list.deallocations, 0));
+    }
+
+    static void Fetch(size_t index, LocalList& list) {
+        SizeClass& size_class = classes[index];
+        LockGuard guard(size_class.lock);
+        AddStats(size_class, list);
+        if (size_class.free == nullptr) {
+            Refill(size_class, (index + 1) * kGranularity);
+        }
+        Slot* first = size_class.free;
+        Slot* last = first;
+        size_t length = 1;
+        while (length < kBatchSize && last->next != nullptr) {
+            last = last->next;
+            ++length;
+        }
+        size_class.free = last->next;
+        last->next = list.free;
+        list.free = first;
+        list.length += length;
+    }
+
+    // Gives the first `count` slots of the thread's list back
+    static void Release(size_t index, LocalList& list, size_t count) noexcept {
+        SizeClass& size_class = classes[index];
+        Slot* first = list.free;
+        Slot* last = nullptr;
+        if (count > 0) {
+            last = first;
+            for (size_t i = 1; i < count; ++i) {
+                last = last->next;
+            }
+            list.free = last->next;
+            list.length -= count;
+        }
+
+        LockGuard guard(size_class.lock);
+        AddStats(size_class, list);
+        if (last != nullptr) {
+            last->next = size_class.free;
+            size_class.free = first;
+        }
+    }
+
+    static void* AllocateShared(size_t index) {
+        SizeClass& size_class = classes[index];
+        LockGuard guard(size_class.lock);
+        Add(size_class.allocations, 1);
+        if (size_class.free == nullptr) {
+            Refill(size_class, (index + 1) * kGranularity);
+        }
+        Slot* slot = size_class.free;
+        size_class.free = slot->next;
+        return slot;
+    }
+
+    static void DeallocateShared(size_t index, Slot* slot) noexcept {
+        SizeClass& size_class = classes[index];
+        LockGuard guard(size_class.lock);
+        Add(size_class.deallocations, 1);
+        slot->next = size_class.free;
+        size_class.free = slot;
+    }
+
+    // Called with the class lock held: threads refilling different classes meet only on the
+    // chunk lock, once per run
+    static void Refill(SizeClass& size_class, size_t slot_size) {
+        auto run = static_cast<char*>(AllocateRun());
+        for (size_t i = kRunSize / slot_size; i > 0; --i) {
+            auto slot = reinterpret_cast<Slot*>(run + (i - 1) * slot_size);
+            slot->next = size_class.free;
+            size_class.free = slot;
+        }
+        Add(size_class.refills, 1);
+    }
+
+    static char* NewChunk() {
+        void* chunk = ::operator new(kChunkSize, std::align_val_t(kChunkSize));
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        madvise(chunk, kChunkSize, MADV_HUGEPAGE);
+#endif
+        chunks.fetch_add(1, std::memory_order_relaxed);
+        return static_cast<char*>(chunk);
+    }
+
+    static SizeClass classes[kNumClasses];
+
+    static thread_local LocalList local_lists[kNumClasses];
+    static inline thread_local ThreadState state = ThreadState::kNew;
+
+    static inline std::atomic_flag chunk_lock = ATOMIC_FLAG_INIT;
+    static inline char* chunk_begin = nullptr;
+    static inline size_t chunk_left = 0;
+    static inline std::atomic<size_t> chunks = 0;
+};
+
+inline Slab::SizeClass Slab::classes[Slab::kNumClasses];
+inline thread_local Slab::LocalList Slab::local_lists[Slab::kNumClasses];
+
+// Standard allocator on top of `Slab`, e.g. for `AllocateShared`. Requests the slab cannot serve
+// (too large or over-aligned) go to `operator new`
+template <typename T>
+class SlabAllocator {
+public:
+    using value_type = T;
+
+    SlabAllocator() noexcept = default;
+
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U>&) noexcept {
+    }
+
+    T* allocate(size_t n) {
+        if (FromSlab(n)) {
+            return static_cast<T*>(Slab::Allocate(n * sizeof(T)));
+        }
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        if (FromSlab(n)) {
+            Slab::Deallocate(ptr, n * sizeof(T));
+        } else {
+            std::allocator<T>().deallocate(ptr, n);
+        }
+    }
+
+    template <typename U>
+    bool operator==(const SlabAllocator<U>&) const noexcept {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const SlabAllocator<U>&) const noexcept {
+        return false;
+    }
+
+private:
+    static bool FromSlab(size_t n) noexcept {
+        return alignof(T) <= Slab::kGranularity && n <= Slab::kMaxSize / sizeof(T);
+    }
+};
@@ -1,50 +1,182 @@
 #pragma once
 
+#include "counters.h"
+#include "../unique/compressed_pair.h"
+
+#ifdef SW_CACHED_BLOCKS
+#include "block_cache.h"
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 class BadWeakPtr : public std::exception {};
 
-class BaseBlock {
+class BaseBlock;
+
+// Counting mode is chosen for the whole program: define `SW_ATOMIC_COUNTERS` or
+// `SW_BIASED_COUNTERS` (in every translation unit) to share pointers between threads.
+// `SW_PACKED_COUNTERS` switches the simple and atomic modes to a single 64-bit counter word.
+// `SW_COUNTING_COUNTERS` counts the updates on top of a single-threaded mode, for tests.
+#if defined(SW_BIASED_COUNTERS)
+#ifdef SW_PACKED_COUNTERS
+#error "Biased counters have no packed layout"
+#endif
+using ModeCounters = BiasedBlockCounters<BaseBlock>;
+#elif defined(SW_PACKED_COUNTERS)
+#ifdef SW_ATOMIC_COUNTERS
+using ModeCounters = PackedBlockCounters<true>;
+#else
+using ModeCounters = PackedBlockCounters<false>;
+#endif
+#elif defined(SW_ATOMIC_COUNTERS)
+using ModeCounters = AtomicBlockCounters;
+#else
+using ModeCounters = SimpleBlockCounters;
+#endif
+
+#ifdef SW_COUNTING_COUNTERS
+using BlockCounters = CountingBlockCounters<ModeCounters>;
+#else
+using BlockCounters = ModeCounters;
+#endif
+
+// Blocks of `SharedPtr(T*)` and `MakeShared` come from the global `operator new`, or from the
+// per-thread `BlockCache` with `SW_CACHED_BLOCKS` defined (in every translation unit)
+#ifdef SW_CACHED_BLOCKS
+using BlockMemory = CachedBlock;
+#else
+class BlockMemory {};
+#endif
+
+// What a block knows about the type it was created for
+enum class BlockOp {
+    kDestroyObject,  // The last strong reference is gone
+    kDeallocate,     // The last weak reference is gone
+    kGetDeleter,     // Address of the deleter if it has the requested type, `nullptr` otherwise
+    kGetObject,      // Address of the owned object (the first element of an array)
+};
+
+template <typename T>
+void* ObjectAddress(T* ptr) noexcept {
+    return const_cast<void*>(static_cast<const volatile void*>(ptr));
+}
+
+// A distinct address for every type, used to look deleters up without RTTI
+template <typename T>
+inline constexpr char kTypeTag = 0;
+
+// A freshly created block is owned by exactly one `SharedPtr`.
+//
+// Blocks are not polymorphic: instead of a vtable pointer each block stores a single function
+// which handles every type-specific operation. It occupies the same word as a vptr but saves
+// the load of the vtable itself, and lets every kind of block (custom deleters, allocators)
+// plug in by providing its own function.
+template <typename Block, typename Counters>
+class BasicBlock : public Counters {
 public:
-    BaseBlock() noexcept = default;
+    using Dispatch = void* (*)(Block* block, BlockOp op, const void* type) noexcept;
 
-    void IncShared() noexcept {
-        ++counter_shared_;
+    explicit BasicBlock(Dispatch dispatch) noexcept : dispatch_(dispatch) {
     }
 
-    void DecShared() noexcept {
-        --counter_shared_;
-    }
+    BasicBlock(const BasicBlock&) = delete;
+    BasicBlock& operator=(const BasicBlock&) = delete;
 
-    void IncWeak() noexcept {
-        ++counter_weak_;
+    // The last weak reference is gone
+    void Deallocate() noexcept {
+        Call(BlockOp::kDeallocate, nullptr);
     }
 
-    void DecWeak() noexcept {
-        --counter_weak_;
+    void* GetDeleter(const void* type) noexcept {
+        return Call(BlockOp::kGetDeleter, type);
     }
 
-    size_t GetShared() const noexcept {
-        return counter_shared_;
+    void* GetObject() noexcept {
+        return Call(BlockOp::kGetObject, nullptr);
     }
 
-    size_t GetWeak() const noexcept {
-        return counter_weak_;
+    // Whether the block is of the kind `dispatch` belongs to
+    bool IsDispatchedBy(Dispatch dispatch) const noexcept {
+        return dispatch_ == dispatch;
     }
 
-    virtual void ObjectDestructor() = 0;
+protected:
+    ~BasicBlock() noexcept = default;
 
-    virtual ~BaseBlock() noexcept = default;
+    void* Call(BlockOp op, const void* type) noexcept {
+        return dispatch_(static_cast<Block*>(this), op, type);
+    }
 
 private:
-    size_t counter_shared_ = 0;
-    size_t counter_weak_ = 0;
+    Dispatch dispatch_;
 };
 
+class BaseBlock : public BasicBlock<BaseBlock, BlockCounters> {
+public:
+    using BasicBlock::BasicBlock;
+
+    // The last strong reference is gone: destroy the object and give up the weak reference held
+    // by the owners. Without `WeakPtr`s (checked after the object, which may hold some) that is
+    // the last reference of all and needs no decrement
+    void DestroyObject() noexcept {
+        Call(BlockOp::kDestroyObject, nullptr);
+        if (IsLastWeak() || DecWeak() == 0) {
+            Deallocate();
+        }
+    }
+
+protected:
+    ~BaseBlock() noexcept = default;
+};
+
+// The block of a type that is never pointed to by a `WeakPtr` keeps the strong count only, and
+// goes away together with the object
+class StrongBlock
+    : public BasicBlock<StrongBlock, StrongBlockCounters<BlockCounters::kThreadSafe>> {
+public:
+    using BasicBlock::BasicBlock;
+
+    void DestroyObject() noexcept {
+        Call(BlockOp::kDestroyObject, nullptr);
+        Deallocate();
+    }
+
+protected:
+    ~StrongBlock() noexcept = default;
+};
+
+// Specialize as `true` for types that are never pointed to by a `WeakPtr`, to give them a
+// `StrongBlock`. `WeakPtr` (and so `EnableSharedFromThis`) does not compile for such a type, and
+// its `SharedPtr` converts only to pointers to other strong-only types. In the biased mode the
+// block has no bias: copies cost an atomic increment even on the creating thread
 template <typename T>
-class ControlBlock1 final : public BaseBlock {
+inline constexpr bool kStrongOnly = false;
+
+template <typename T>
+using BlockFor = std::conditional_t<kStrongOnly<std::remove_cv_t<std::remove_extent_t<T>>>,
+                                    StrongBlock, BaseBlock>;
+
+// Passed instead of constructor arguments to default-initialize the object (`new T` rather than
+// `new T()`), leaving trivial types such as byte buffers uninitialized
+struct ForOverwriteTag {};
+
+template <typename... Args>
+inline constexpr bool kForOverwrite =
+    sizeof...(Args) == 1 && (std::is_same_v<std::decay_t<Args>, ForOverwriteTag> && ...);
+
+template <typename T>
+class ControlBlock1 final : public BlockFor<T>, public BlockMemory {
+    using Base = BlockFor<T>;
+
 public:
-    ControlBlock1(T* ptr) noexcept : BaseBlock() {
+    ControlBlock1(T* ptr) noexcept : Base(&Dispatch) {
         ptr_ = ptr;
     }
 
@@ -52,36 +184,368 @@ public:
         return ptr_;
     }
 
-    void ObjectDestructor() override {
-        delete ptr_;
+private:
+    static void* Dispatch(Base* base, BlockOp op, const void*) noexcept {
+        auto block = static_cast<ControlBlock1*>(base);
+        switch (op) {
+            case BlockOp::kDestroyObject:
+                delete block->ptr_;
+                break;
+            case BlockOp::kDeallocate:
+                delete block;
+                break;
+            case BlockOp::kGetDeleter:
+                break;
+            case BlockOp::kGetObject:
+                return ObjectAddress(block->Get());
+        }
+        return nullptr;
+    }
+
+    T* ptr_ = nullptr;
+};
+
+// Counters and the object share a cache line in a normal block. Threads writing to the object
+// then slow down threads copying pointers to it and vice versa (false sharing), so a `Padded`
+// block moves the object to a line of its own
+inline constexpr size_t kCacheLineSize = 64;
+
+template <typename T, bool Padded = false>
+class ControlBlock2 final : public BlockFor<T>, public BlockMemory {
+    using Base = BlockFor<T>;
+
+public:
+    template <typename... Args>
+    ControlBlock2(Args&&... args) : Base(&Dispatch) {
+        if constexpr (kForOverwrite<Args...>) {
+            new (Get()) T;
+        } else {
+            new (Get()) T(std::forward<Args>(args)...);
+        }
+    }
+
+    T* Get() noexcept {
+        return reinterpret_cast<T*>(&storage_);
     }
 
-    ~ControlBlock1() noexcept = default;
+    // Whether `block` is exactly this kind of block, so it may be cast to it
+    static bool IsKindOf(const Base* block) noexcept {
+        return block->IsDispatchedBy(&Dispatch);
+    }
 
 private:
-    T* ptr_ = nullptr;
+    static void* Dispatch(Base* base, BlockOp op, const void*) noexcept {
+        auto block = static_cast<ControlBlock2*>(base);
+        switch (op) {
+            case BlockOp::kDestroyObject:
+                block->Get()->~T();
+                break;
+            case BlockOp::kDeallocate:
+                delete block;
+                break;
+            case BlockOp::kGetDeleter:
+                break;
+            case BlockOp::kGetObject:
+                return ObjectAddress(block->Get());
+        }
+        return nullptr;
+    }
+
+    static constexpr size_t kAlignment = Padded ? std::max(kCacheLineSize, alignof(T)) : alignof(T);
+
+    alignas(kAlignment) std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
 };
 
+// Arrays: elements are value-initialized (default-initialized for `ForOverwriteTag`, or copies
+// of a given value) and destroyed in reverse order. If a constructor throws, the elements built
+// so far are destroyed
 template <typename T>
-class ControlBlock2 final : public BaseBlock {
+void DestroyElements(T* elements, size_t count) noexcept {
+    while (count > 0) {
+        elements[--count].~T();
+    }
+}
+
+template <typename T, typename... Args>
+void ConstructElements(T* elements, size_t count, const Args&... args) {
+    size_t built = 0;
+    try {
+        for (; built < count; ++built) {
+            if constexpr (kForOverwrite<Args...>) {
+                new (elements + built) T;
+            } else {
+                new (elements + built) T(args...);
+            }
+        }
+    } catch (...) {
+        DestroyElements(elements, built);
+        throw;
+    }
+}
+
+template <typename T, size_t N>
+class ControlBlock2<T[N]> final : public BlockFor<T> {
+    using Base = BlockFor<T>;
+
 public:
     template <typename... Args>
-    ControlBlock2(Args&&... args) {
-        new (Get()) T(std::forward<Args>(args)...);
+    ControlBlock2(const Args&... args) : Base(&Dispatch) {
+        ConstructElements(Get(), N, args...);
     }
 
     T* Get() noexcept {
         return reinterpret_cast<T*>(&storage_);
     }
 
-    void ObjectDestructor() override {
-        Get()->~T();
+private:
+    static void* Dispatch(Base* base, BlockOp op, const void*) noexcept {
+        auto block = static_cast<ControlBlock2*>(base);
+        switch (op) {
+            case BlockOp::kDestroyObject:
+                DestroyElements(block->Get(), N);
+                break;
+            case BlockOp::kDeallocate:
+                delete block;
+                break;
+            case BlockOp::kGetDeleter:
+                break;
+            case BlockOp::kGetObject:
+                return ObjectAddress(block->Get());
+        }
+        return nullptr;
     }
 
-    ~ControlBlock2() noexcept = default;
+    std::aligned_storage_t<sizeof(T[N]), alignof(T)> storage_;
+};
+
+// The element count is known at run time only, so the elements follow the block in the same
+// allocation
+template <typename T>
+class ControlBlock2<T[]> final : public BlockFor<T> {
+    using Base = BlockFor<T>;
+
+public:
+    template <typename... Args>
+    static ControlBlock2* Create(size_t count, const Args&... args) {
+        if (count > (SIZE_MAX - ElementsOffset()) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+
+        void* memory = Allocate(ElementsOffset() + count * sizeof(T));
+        auto block = new (memory) ControlBlock2(count);
+        try {
+            ConstructElements(block->Get(), count, args...);
+        } catch (...) {
+            block->~ControlBlock2();
+            Free(memory);
+            throw;
+        }
+        return block;
+    }
+
+    T* Get() noexcept {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + ElementsOffset());
+    }
+
+private:
+    explicit ControlBlock2(size_t count) noexcept : Base(&Dispatch), count_(count) {
+    }
+
+    static constexpr size_t kAlignment = std::max(alignof(T), alignof(Base));
+    static constexpr bool kOverAligned = kAlignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    static constexpr size_t ElementsOffset() noexcept {
+        return (sizeof(ControlBlock2) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    static void* Allocate(size_t size) {
+        if constexpr (kOverAligned) {
+            return ::operator new(size, std::align_val_t(kAlignment));
+        } else {
+            return ::operator new(size);
+        }
+    }
+
+    static void Free(void* memory) noexcept {
+        if constexpr (kOverAligned) {
+            ::operator delete(memory, std::align_val_t(kAlignment));
+        } else {
+            ::operator delete(memory);
+        }
+    }
+
+    static void* Dispatch(Base* base, BlockOp op, const void*) noexcept {
+        auto block = static_cast<ControlBlock2*>(base);
+        switch (op) {
+            case BlockOp::kDestroyObject:
+                DestroyElements(block->Get(), block->count_);
+                break;
+            case BlockOp::kDeallocate:
+                block->~ControlBlock2();
+                Free(block);
+                break;
+            case BlockOp::kGetDeleter:
+                break;
+            case BlockOp::kGetObject:
+                return ObjectAddress(block->Get());
+        }
+        return nullptr;
+    }
+
+    size_t count_;
+};
+
+// Stateless deleters are stored as an empty base and take no space
+template <typename T, typename Deleter>
+class ControlBlockDeleter final : public BlockFor<T> {
+    using Base = BlockFor<T>;
+
+public:
+    ControlBlockDeleter(T* ptr, Deleter&& deleter)
+        : Base(&Dispatch), data_(ptr, std::move(deleter)) {
+    }
 
 private:
-    std::aligned_storage_t<sizeof(T), alignof(T)> storage_;
+    static void* Dispatch(Base* base, BlockOp op, const void* type) noexcept {
+        auto block = static_cast<ControlBlockDeleter*>(base);
+        switch (op) {
+            case BlockOp::kDestroyObject:
+                block->data_.GetSecond()(block->data_.GetFirst());
+                break;
+            case BlockOp::kDeallocate:
+                delete block;
+                break;
+            case BlockOp::kGetDeleter:
+                if (type == &kTypeTag<Deleter>) {
+                    return &block->data_.GetSecond();
+                }
+                break;
+            case BlockOp::kGetObject:
+                return ObjectAddress(block->data_.GetFirst());
+        }
+        return nullptr;
+    }
+
+    CompressedPair<T*, Deleter> data_;
+};
+
+// Object and counters in one allocation obtained from `Alloc` rebound to the block type.
+// Stateless allocators are stored as an empty base and take no space
+template <typename T, typename Alloc>
+class ControlBlockAlloc final : public BlockFor<T> {
+    using Base = BlockFor<T>;
+    using BlockAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockAlloc>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+    using ObjectAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<std::remove_cv_t<T>>;
+    using ObjectTraits = std::allocator_traits<ObjectAlloc>;
+
+public:
+    template <typename... Args>
+    static ControlBlockAlloc* Create(const Alloc& alloc, Args&&... args) {
+        BlockAlloc block_alloc(alloc);
+        ControlBlockAlloc* block = BlockTraits::allocate(block_alloc, 1);
+        try {
+            new (block) ControlBlockAlloc(std::move(block_alloc), std::forward<Args>(args)...);
+        } catch (...) {
+            BlockTraits::deallocate(block_alloc, block, 1);
+            throw;
+        }
+        return block;
+    }
+
+    T* Get() noexcept {
+        return reinterpret_cast<T*>(&data_.GetSecond());
+    }
+
+private:
+    template <typename... Args>
+    ControlBlockAlloc(BlockAlloc&& alloc, Args&&... args)
+        : Base(&Dispatch), data_(std::move(alloc), Storage()) {
+        ObjectAlloc object_alloc(data_.GetFirst());
+        ObjectTraits::construct(object_alloc, const_cast<std::remove_cv_t<T>*>(Get()),
+                                std::forward<Args>(args)...);
+    }
+
+    static void* Dispatch(Base* base, BlockOp op, const void*) noexcept {
+        auto block = static_cast<ControlBlockAlloc*>(base);
+        switch (op) {
+            case BlockOp::kDestroyObject: {
+                ObjectAlloc object_alloc(block->data_.GetFirst());
+                ObjectTraits::destroy(object_alloc, const_cast<std::remove_cv_t<T>*>(block->Get()));
+                break;
+            }
+            case BlockOp::kDeallocate: {
+                // The allocator lives inside the block: move it out before freeing the memory
+                BlockAlloc block_alloc(std::move(block->data_.GetFirst()));
+                block->~ControlBlockAlloc();
+                BlockTraits::deallocate(block_alloc, block, 1);
+                break;
+            }
+            case BlockOp::kGetDeleter:
+                break;
+            case BlockOp::kGetObject:
+                return ObjectAddress(block->Get());
+        }
+        return nullptr;
+    }
+
+    using Storage = std::aligned_storage_t<sizeof(T), alignof(T)>;
+
+    CompressedPair<BlockAlloc, Storage> data_;
+};
+
+// `ControlBlockDeleter` in memory obtained from `Alloc` rebound to the block type, so that the
+// block of an object created elsewhere can come from e.g. `SlabAllocator`
+template <typename T, typename Deleter, typename Alloc>
+class ControlBlockDeleterAlloc final : public BlockFor<T> {
+    using Base = BlockFor<T>;
+    using BlockAlloc =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<ControlBlockDeleterAlloc>;
+    using BlockTraits = std::allocator_traits<BlockAlloc>;
+
+public:
+    // `deleter` is left untouched if the allocation fails
+    static ControlBlockDeleterAlloc* Create(T* ptr, Deleter&& deleter, const Alloc& alloc) {
+        BlockAlloc block_alloc(alloc);
+        ControlBlockDeleterAlloc* block = BlockTraits::allocate(block_alloc, 1);
+        new (block) ControlBlockDeleterAlloc(ptr, std::move(deleter), std::move(block_alloc));
+        return block;
+    }
+
+private:
+    ControlBlockDeleterAlloc(T* ptr, Deleter&& deleter, BlockAlloc&& alloc) noexcept
+        : Base(&Dispatch), data_(ptr, Policies(std::move(deleter), std::move(alloc))) {
+    }
+
+    static void* Dispatch(Base* base, BlockOp op, const void* type) noexcept {
+        auto block = static_cast<ControlBlockDeleterAlloc*>(base);
+        switch (op) {
+            case BlockOp::kDestroyObject:
+                block->data_.GetSecond().GetFirst()(block->data_.GetFirst());
+                break;
+            case BlockOp::kDeallocate: {
+                // The allocator lives inside the block: move it out before freeing the memory
+                BlockAlloc block_alloc(std::move(block->data_.GetSecond().GetSecond()));
+                block->~ControlBlockDeleterAlloc();
+                BlockTraits::deallocate(block_alloc, block, 1);
+                break;
+            }
+            case BlockOp::kGetDeleter:
+                if (type == &kTypeTag<Deleter>) {
+                    return &block->data_.GetSecond().GetFirst();
+                }
+                break;
+            case BlockOp::kGetObject:
+                return ObjectAddress(block->data_.GetFirst());
+        }
+        return nullptr;
+    }
+
+    using Policies = CompressedPair<Deleter, BlockAlloc>;
+
+    CompressedPair<T*, Policies> data_;
 };
 
 template <typename T>
@@ -90,7 +554,166 @@ class SharedPtr;
 template <typename T>
 class WeakPtr;
 
+template <typename T>
+class AtomicSharedPtr;
+
+template <typename T>
+class CompactSharedPtr;
+
+template <typename T>
+class ThinWeakPtr;
+
 class ESFTBase {};
 
 template <typename T>
 class EnableSharedFromThis;
+
+template <typename T>
+class EmbeddedSharedFromThis;
+
+// Base of `EmbeddedSharedFromThis`. `new` puts a header in front of the object, where
+// `SharedPtr` builds the control block when it takes the object over: both share one
+// allocation, and the header outlives the object for as long as `WeakPtr`s to it exist.
+// Derived classes must not replace `operator new`, and over-aligned ones are not supported
+class EmbeddedESFTBase : public ESFTBase {
+    template <typename T>
+    friend class SharedPtr;
+
+    template <typename T>
+    friend class EmbeddedSharedFromThis;
+
+public:
+    // Room for a `BaseBlock` and the object pointer, keeping the object aligned
+    static constexpr size_t kHeaderSize =
+        (sizeof(BaseBlock) + sizeof(void*) + __STDCPP_DEFAULT_NEW_ALIGNMENT__ - 1) /
+        __STDCPP_DEFAULT_NEW_ALIGNMENT__ * __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    static void* operator new(size_t size) {
+        if (size > SIZE_MAX - kHeaderSize) {
+            throw std::bad_alloc();
+        }
+        return static_cast<char*>(::operator new(kHeaderSize + size)) + kHeaderSize;
+    }
+
+    static void operator delete(void* ptr) noexcept {
+        ::operator delete(static_cast<char*>(ptr) - kHeaderSize);
+    }
+
+    static void* operator new(size_t size, std::align_val_t alignment) = delete;
+
+    // A class `operator new` hides the global placement form, which `MakeShared` needs
+    static void* operator new(size_t, void* place) noexcept {
+        return place;
+    }
+
+    static void operator delete(void*, void*) noexcept {
+    }
+
+protected:
+    EmbeddedESFTBase() noexcept = default;
+
+    // A copy is another object, with no owners yet
+    EmbeddedESFTBase(const EmbeddedESFTBase&) noexcept {
+    }
+
+    EmbeddedESFTBase& operator=(const EmbeddedESFTBase&) noexcept {
+        return *this;
+    }
+
+    ~EmbeddedESFTBase() = default;
+
+private:
+    // Set where the object gets its first owner. Not a reference: the block lives at least as
+    // long as the object does
+    BaseBlock* block_ = nullptr;
+};
+
+// The block in the header of an object created by `new` through `EmbeddedESFTBase`. `ptr` must
+// not be null: a null pointer has no header and gets a `ControlBlock1` instead
+template <typename T>
+class ControlBlockEmbedded final : public BaseBlock {
+public:
+    static ControlBlockEmbedded* Create(T* ptr) noexcept {
+        static_assert(sizeof(ControlBlockEmbedded) <= EmbeddedESFTBase::kHeaderSize);
+
+        const volatile void* object;
+        if constexpr (std::is_polymorphic_v<T>) {
+            object = dynamic_cast<const volatile void*>(ptr);
+        } else {
+            object = ptr;
+        }
+        auto header = const_cast<char*>(static_cast<const volatile char*>(object)) -
+                      EmbeddedESFTBase::kHeaderSize;
+        return new (header) ControlBlockEmbedded(ptr);
+    }
+
+private:
+    explicit ControlBlockEmbedded(T* ptr) noexcept : BaseBlock(&Dispatch), ptr_(ptr) {
+    }
+
+    static void* Dispatch(BaseBlock* base, BlockOp op, const void*) noexcept {
+        auto block = static_cast<ControlBlockEmbedded*>(base);
+        switch (op) {
+            case BlockOp::kDestroyObject:
+                // The memory goes away with the block
+                std::destroy_at(block->ptr_);
+                break;
+            case BlockOp::kDeallocate:
+                block->~ControlBlockEmbedded();
+                ::operator delete(block);
+                break;
+            case BlockOp::kGetDeleter:
+                break;
+            case BlockOp::kGetObject:
+                return ObjectAddress(block->ptr_);
+        }
+        return nullptr;
+    }
+
+    T* ptr_;
+};
+
+// Deleter of a `UniquePtr` made by `MakeShareableUnique`: the object already lives in a control
+// block, which `SharedPtr` takes over when the pointer is shared. Until then the block stays
+// unused, and the deleter releases it as the only owner
+class ShareableDelete {
+    template <typename T>
+    friend class SharedPtr;
+
+public:
+    ShareableDelete() noexcept = default;
+
+    explicit ShareableDelete(BaseBlock* block) noexcept : block_(block) {
+    }
+
+    template <typename T>
+    void operator()(T* ptr) const noexcept {
+        if (ptr != nullptr && block_->DecShared() == 0) {
+            block_->DestroyObject();
+        }
+    }
+
+private:
+    BaseBlock* block_ = nullptr;
+};
+
+// Deleter of a `UniquePtr` made by `TryUnwrap`: the strong count is already zero, what is left
+// is to destroy the object and give up the owners' weak reference
+template <typename Block>
+class UnwrappedDelete {
+public:
+    UnwrappedDelete() noexcept = default;
+
+    explicit UnwrappedDelete(Block* block) noexcept : block_(block) {
+    }
+
+    template <typename T>
+    void operator()(T* ptr) const noexcept {
+        if (ptr != nullptr) {
+            block_->DestroyObject();
+        }
+    }
+
+private:
+    Block* block_ = nullptr;
+};
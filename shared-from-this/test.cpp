@@ -3,6 +3,8 @@
 
 #include <catch.hpp>
 
+#include "allocations_checker.h"
+
 struct T : public EnableSharedFromThis<T> {};
 
 struct Y : T {};
@@ -89,3 +91,169 @@ TEST_CASE("WeakFromThis") {
     REQUIRE(!weak.Expired());
     REQUIRE(weak.Lock().Get() == ptr);
 }
+
+struct Member : public EnableSharedFromThis<Member> {};
+
+struct Holder {
+    Member member;
+};
+
+TEST_CASE("Copies leave weak_this_ alone") {
+    SECTION("Empty") {
+        SharedPtr<T> empty;
+        SharedPtr<T> copy(empty);
+        SharedPtr<T> moved(std::move(empty));
+        SharedPtr<T> converted(SharedPtr<Z>{});
+        REQUIRE(!copy);
+        REQUIRE(!moved);
+        REQUIRE(!converted);
+    }
+
+    SECTION("Owners") {
+        auto owner = MakeShared<Z>();
+        SharedPtr<T> copy(owner);
+        SharedPtr<T> moved(std::move(copy));
+        REQUIRE(moved->SharedFromThis() == owner);
+        REQUIRE(owner.UseCount() == 2);
+    }
+
+    // Like `std::shared_ptr`: an aliasing pointer does not take `weak_this_` over
+    SECTION("Aliasing") {
+        auto holder = MakeShared<Holder>();
+        SharedPtr<Member> alias(holder, &holder->member);
+        SharedPtr<Member> copy(alias);
+        SharedPtr<Member> moved(std::move(copy));
+        REQUIRE(moved->WeakFromThis().Expired());
+        REQUIRE(!moved->SharedFromThis());
+    }
+}
+
+struct Embedded : public EmbeddedSharedFromThis<Embedded> {
+    static inline int alive = 0;
+
+    Embedded() {
+        ++alive;
+    }
+
+    Embedded(const Embedded&) : Embedded() {
+    }
+
+    Embedded& operator=(const Embedded&) = default;
+
+    virtual ~Embedded() {
+        --alive;
+    }
+
+    int value = 42;
+};
+
+struct Unrelated {
+    virtual ~Unrelated() = default;
+
+    int padding = 0;
+};
+
+// `Embedded` is not the first base: the header is found through the complete object
+struct EmbeddedLeaf : Unrelated, Embedded {};
+
+TEST_CASE("EmbeddedSharedFromThis") {
+    SECTION("One allocation") {
+        auto raw = new Embedded;
+        SharedPtr<Embedded> owner;
+        EXPECT_ZERO_ALLOCATIONS(owner = SharedPtr<Embedded>(raw));
+        REQUIRE(owner->SharedFromThis() == owner);
+        REQUIRE(owner.UseCount() == 1);
+        owner.Reset();
+        REQUIRE(Embedded::alive == 0);
+    }
+
+    SECTION("WeakPtrs keep the header") {
+        SharedPtr<Embedded> owner(new Embedded);
+        WeakPtr<Embedded> weak = owner->WeakFromThis();
+        WeakPtr<const Embedded> const_weak =
+            static_cast<const Embedded&>(*owner).WeakFromThis();
+        REQUIRE(weak.Lock() == owner);
+        REQUIRE(const_weak.Lock()->value == 42);
+
+        owner.Reset();
+        REQUIRE(Embedded::alive == 0);
+        REQUIRE(weak.Expired());
+        REQUIRE(!const_weak.Lock());
+    }
+
+    SECTION("Not owned") {
+        Embedded local;
+        REQUIRE(!local.SharedFromThis());
+        REQUIRE(local.WeakFromThis().Expired());
+
+        auto raw = new Embedded;
+        REQUIRE(!raw->SharedFromThis());
+        delete raw;
+        REQUIRE(Embedded::alive == 1);
+    }
+
+    SECTION("Null") {
+        SharedPtr<Embedded> owner(static_cast<Embedded*>(nullptr));
+        REQUIRE(!owner);
+        REQUIRE(owner.UseCount() == 1);
+        SharedPtr<Embedded> copy = owner;
+        REQUIRE(owner.UseCount() == 2);
+        owner.Reset(static_cast<Embedded*>(nullptr));
+        REQUIRE(copy.UseCount() == 1);
+    }
+
+    SECTION("Copies have no owners") {
+        SharedPtr<Embedded> owner(new Embedded);
+        Embedded copy(*owner);
+        REQUIRE(!copy.SharedFromThis());
+        copy = *owner;
+        REQUIRE(!copy.SharedFromThis());
+    }
+
+    SECTION("Through a base") {
+        SharedPtr<Embedded> owner(static_cast<Embedded*>(new EmbeddedLeaf));
+        REQUIRE(owner->SharedFromThis() == owner);
+        SharedPtr<Unrelated> other = DynamicPointerCast<Unrelated>(owner->SharedFromThis());
+        REQUIRE(other);
+        owner.Reset();
+        REQUIRE(Embedded::alive == 1);
+        other.Reset();
+        REQUIRE(Embedded::alive == 0);
+    }
+
+    SECTION("Other ways to own") {
+        auto made = MakeShared<Embedded>();
+        REQUIRE(made->SharedFromThis() == made);
+
+        SharedPtr<Embedded> with_deleter(new Embedded, [](Embedded* ptr) { delete ptr; });
+        REQUIRE(with_deleter->SharedFromThis() == with_deleter);
+
+        SharedPtr<const Embedded> constant(new const Embedded);
+        REQUIRE(constant->SharedFromThis() == constant);
+    }
+}
+
+struct LooksBack : public EmbeddedSharedFromThis<LooksBack> {
+    ~LooksBack() {
+        revived = static_cast<bool>(SharedFromThis());
+        expired = WeakFromThis().Expired();
+    }
+
+    static inline bool revived = true;
+    static inline bool expired = false;
+};
+
+// The same in every counting mode, including the release without `WeakPtr`s that skips the
+// decrement
+TEST_CASE("SharedFromThis in the destructor") {
+    SECTION("new") {
+        SharedPtr<LooksBack> owner(new LooksBack);
+    }
+
+    SECTION("MakeShared") {
+        auto owner = MakeShared<LooksBack>();
+    }
+
+    REQUIRE(!LooksBack::revived);
+    REQUIRE(LooksBack::expired);
+}
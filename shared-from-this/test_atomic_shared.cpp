@@ -0,0 +1,126 @@
+#include "atomic_shared.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Config {
+    static inline std::atomic<int> alive = 0;
+
+    explicit Config(int version) : version(version), checksum(-version) {
+        ++alive;
+    }
+
+    ~Config() {
+        --alive;
+    }
+
+    int version;
+    int checksum;
+};
+
+TEST_CASE("AtomicSharedPtr basics") {
+    SECTION("Empty") {
+        AtomicSharedPtr<int> atomic;
+        REQUIRE(atomic.IsLockFree());
+        REQUIRE(atomic.Load().Get() == nullptr);
+    }
+
+    SECTION("Load/Store/Exchange") {
+        auto first = MakeShared<int>(1);
+        AtomicSharedPtr<int> atomic(first);
+        REQUIRE(first.UseCount() == 2);
+
+        auto loaded = atomic.Load();
+        REQUIRE(loaded == first);
+        REQUIRE(first.UseCount() == 3);
+
+        atomic.Store(MakeShared<int>(2));
+        REQUIRE(*atomic.Load() == 2);
+        REQUIRE(first.UseCount() == 2);
+
+        auto old = atomic.Exchange(first);
+        REQUIRE(*old == 2);
+        REQUIRE(old.UseCount() == 1);
+        REQUIRE(atomic.Load() == first);
+    }
+
+    SECTION("CompareExchange") {
+        auto first = MakeShared<int>(1);
+        auto second = MakeShared<int>(2);
+        AtomicSharedPtr<int> atomic(first);
+
+        SharedPtr<int> expected = second;
+        REQUIRE(!atomic.CompareExchange(expected, MakeShared<int>(3)));
+        REQUIRE(expected == first);
+
+        REQUIRE(atomic.CompareExchange(expected, second));
+        REQUIRE(atomic.Load() == second);
+        REQUIRE(first.UseCount() == 2);  // `first` and `expected`
+    }
+
+    SECTION("Same pointer, different owner") {
+        auto owner = MakeShared<int>(1);
+        SharedPtr<int> alias(MakeShared<int>(2), owner.Get());
+        AtomicSharedPtr<int> atomic(owner);
+
+        REQUIRE(!atomic.CompareExchange(alias, nullptr));
+        REQUIRE(alias == owner);
+    }
+}
+
+TEST_CASE("AtomicSharedPtr concurrent publishing") {
+    constexpr int kReaders = 4;
+    constexpr int kVersions = 2'000;
+
+    {
+        AtomicSharedPtr<Config> config(MakeShared<Config>(0));
+        std::atomic<bool> done = false;
+        std::atomic<bool> torn = false;
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kReaders; ++i) {
+            threads.emplace_back([&] {
+                int last = 0;
+                while (!done.load()) {
+                    auto snapshot = config.Load();
+                    if (snapshot->checksum != -snapshot->version || snapshot->version < last) {
+                        torn = true;
+                    }
+                    last = snapshot->version;
+                }
+            });
+        }
+
+        threads.emplace_back([&] {
+            for (int version = 1; version <= kVersions; ++version) {
+                config.Store(MakeShared<Config>(version));
+            }
+        });
+        threads.emplace_back([&] {
+            // Replacements racing with the stores above
+            for (int i = 0; i < kVersions; ++i) {
+                auto expected = config.Load();
+                while (!config.CompareExchange(expected, MakeShared<Config>(expected->version))) {
+                }
+            }
+        });
+
+        threads[kReaders].join();
+        threads[kReaders + 1].join();
+        done = true;
+        for (int i = 0; i < kReaders; ++i) {
+            threads[i].join();
+        }
+
+        REQUIRE(!torn);
+        REQUIRE(config.Load().UseCount() == 2);
+    }
+
+    BlockCounters::CollectDeferred();
+    REQUIRE(Config::alive == 0);
+}
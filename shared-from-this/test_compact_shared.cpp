@@ -0,0 +1,100 @@
+#include "compact_shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("CompactSharedPtr basics") {
+    SECTION("One word") {
+        static_assert(sizeof(CompactSharedPtr<int>) == sizeof(void*));
+        static_assert(sizeof(CompactSharedPtr<std::string>) == sizeof(void*));
+    }
+
+    SECTION("Empty") {
+        CompactSharedPtr<int> a;
+        CompactSharedPtr<int> b(nullptr);
+        REQUIRE(a.Get() == nullptr);
+        REQUIRE(!b);
+        REQUIRE(a.UseCount() == 0);
+        REQUIRE(SharedPtr<int>(a).Get() == nullptr);
+        REQUIRE(CompactSharedPtr<int>(SharedPtr<int>()).Get() == nullptr);
+    }
+
+    SECTION("Copy/move") {
+        auto a = MakeCompactShared<std::string>("aba");
+        auto b = a;
+        REQUIRE(a.UseCount() == 2);
+        REQUIRE(*b == "aba");
+        REQUIRE(b->size() == 3);
+
+        CompactSharedPtr<std::string> c(std::move(a));
+        REQUIRE(!a);
+        REQUIRE(c == b);
+        c.Reset();
+        REQUIRE(b.UseCount() == 1);
+    }
+}
+
+TEST_CASE("CompactSharedPtr and SharedPtr") {
+    SECTION("Same object") {
+        auto shared = MakeShared<std::string>("caba");
+        CompactSharedPtr<std::string> compact(shared);
+        REQUIRE(compact.Get() == shared.Get());
+        REQUIRE(shared.UseCount() == 2);
+
+        SharedPtr<std::string> back = compact;
+        REQUIRE(back == shared);
+        REQUIRE(shared.UseCount() == 3);
+    }
+
+    SECTION("Moves do not touch the counters") {
+        auto shared = MakeShared<int>(42);
+        auto ptr = shared.Get();
+        CompactSharedPtr<int> compact(std::move(shared));
+        REQUIRE(shared.Get() == nullptr);
+        REQUIRE(compact.UseCount() == 1);
+
+        SharedPtr<int> back = std::move(compact);
+        REQUIRE(!compact);
+        REQUIRE(back.Get() == ptr);
+        REQUIRE(back.UseCount() == 1);
+    }
+
+    SECTION("WeakPtr") {
+        auto compact = MakeCompactShared<int>(42);
+        WeakPtr<int> weak{SharedPtr<int>(compact)};
+        REQUIRE(*weak.Lock() == 42);
+        compact.Reset();
+        REQUIRE(weak.Expired());
+    }
+
+    SECTION("Objects outside the block are rejected") {
+        SharedPtr<int> separate(new int(42));
+        REQUIRE_THROWS_AS(CompactSharedPtr<int>(separate), BadCompactSharedPtr);
+
+        struct Pair {
+            int first;
+            int second;
+        };
+        auto pair = MakeShared<Pair>();
+        SharedPtr<int> alias(pair, &pair->second);
+        REQUIRE_THROWS_AS(CompactSharedPtr<int>(alias), BadCompactSharedPtr);
+        REQUIRE(pair.UseCount() == 2);
+
+        // Sits where an `int` block keeps its object, but the block holds a `Pair`
+        SharedPtr<int> first(pair, &pair->first);
+        REQUIRE_THROWS_AS(CompactSharedPtr<int>(first), BadCompactSharedPtr);
+
+        REQUIRE_THROWS_AS(CompactSharedPtr<int>(MakeSharedPadded<int>(42)), BadCompactSharedPtr);
+    }
+
+    SECTION("No allocations") {
+        auto shared = MakeShared<int>(42);
+        EXPECT_ZERO_ALLOCATIONS(CompactSharedPtr<int>{shared});
+    }
+}
@@ -0,0 +1,90 @@
+#include "cow.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Biased counters have no exact use count for `CowPtr` to rely on
+#ifndef SW_BIASED_COUNTERS
+
+TEST_CASE("CowPtr basics") {
+    SECTION("Empty") {
+        CowPtr<int> a;
+        CowPtr<int> b(nullptr);
+        REQUIRE(!a);
+        REQUIRE(!b);
+        REQUIRE(a.UseCount() == 0);
+    }
+
+    SECTION("Read") {
+        auto cow = MakeCow<std::string>("aba");
+        REQUIRE(cow.Read() == "aba");
+        REQUIRE(*cow == "aba");
+        REQUIRE(cow->size() == 3);
+    }
+
+    SECTION("Copies share the object") {
+        auto a = MakeCow<std::string>("aba");
+        CowPtr<std::string> b;
+        EXPECT_ZERO_ALLOCATIONS(b = a);
+        REQUIRE(&a.Read() == &b.Read());
+        REQUIRE(a.UseCount() == 2);
+    }
+
+    SECTION("Swap and Reset") {
+        auto a = MakeCow<int>(1);
+        auto b = MakeCow<int>(2);
+        a.Swap(b);
+        REQUIRE(*a == 2);
+        REQUIRE(*b == 1);
+        a.Reset();
+        REQUIRE(!a);
+    }
+}
+
+TEST_CASE("CowPtr::Write") {
+    SECTION("Unique: in place") {
+        auto cow = MakeCow<std::vector<int>>(3, 1);
+        const auto* object = &cow.Read();
+        EXPECT_ZERO_ALLOCATIONS(cow.Write()[0] = 2);
+        REQUIRE(&cow.Read() == object);
+        REQUIRE(cow.Read()[0] == 2);
+    }
+
+    SECTION("Shared: the writer gets a clone") {
+        auto original = MakeCow<std::vector<int>>(3, 1);
+        auto snapshot = original;
+
+        original.Write()[0] = 2;
+        REQUIRE(original.Read()[0] == 2);
+        REQUIRE(snapshot.Read()[0] == 1);
+        REQUIRE(original.UseCount() == 1);
+        REQUIRE(snapshot.UseCount() == 1);
+
+        // Now both are unique
+        const auto* object = &original.Read();
+        original.Write()[1] = 3;
+        REQUIRE(&original.Read() == object);
+        snapshot.Write()[1] = 4;
+        REQUIRE(snapshot.Read() == std::vector<int>{1, 4, 1});
+    }
+
+    SECTION("Unique again after the other copies are gone") {
+        auto cow = MakeCow<std::string>("aba");
+        const auto* object = &cow.Read();
+        {
+            auto copy = cow;
+            REQUIRE(copy.Read() == "aba");
+        }
+        cow.Write() += "caba";
+        REQUIRE(&cow.Read() == object);
+        REQUIRE(*cow == "abacaba");
+    }
+}
+
+#endif
@@ -1,10 +1,15 @@
+#include "block_cache.h"
 #include "shared.h"
 
 #include <catch.hpp>
 
 #include "allocations_checker.h"
+#include "../unique/deleters.h"
 
+#include <array>
+#include <cstdint>
 #include <memory>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -330,7 +335,13 @@ struct Throwing {
 
 TEST_CASE("MakeShared") {
     SECTION("One allocation") {
+#ifdef SW_CACHED_BLOCKS
+        // The thread's block cache has a run for this size after the first block
+        { auto warm_up = MakeShared<int>(0); }
+        EXPECT_ZERO_ALLOCATIONS(REQUIRE(*MakeShared<int>(42) == 42));
+#else
         EXPECT_ONE_ALLOCATION(REQUIRE(*MakeShared<int>(42) == 42));
+#endif
     }
 
     SECTION("Parameters passing") {
@@ -431,6 +442,106 @@ TEST_CASE("Type conversions") {
     }
 }
 
+class Other : public Base {};
+
+#ifdef SW_COUNTING_COUNTERS
+// Updates of the block counters since the start of the test build
+static size_t CounterUpdates() {
+    return BlockCounters::increments + BlockCounters::decrements;
+}
+#endif
+
+TEST_CASE("Pointer casts") {
+    SharedPtr<Base> base(new Derived);
+
+    SECTION("Copy") {
+#ifdef SW_COUNTING_COUNTERS
+        auto increments = BlockCounters::increments;
+#endif
+        SharedPtr<Derived> derived = StaticPointerCast<Derived>(base);
+        REQUIRE(derived.Get() == base.Get());
+        REQUIRE(base.UseCount() == 2);
+#ifdef SW_COUNTING_COUNTERS
+        REQUIRE(BlockCounters::increments == increments + 1);
+#endif
+
+        REQUIRE(DynamicPointerCast<Derived>(base) == derived);
+        REQUIRE(DynamicPointerCast<Other>(base).UseCount() == 0);
+
+        SharedPtr<const Base> constant = base;
+        REQUIRE(ConstPointerCast<Base>(constant) == base);
+        REQUIRE(ReinterpretPointerCast<char>(base).Get() == reinterpret_cast<char*>(base.Get()));
+        REQUIRE(base.UseCount() == 3);
+    }
+
+    // The reference moves along and leaves the source empty, nothing is allocated
+    SECTION("Move") {
+        Base* raw = base.Get();
+#ifdef SW_COUNTING_COUNTERS
+        auto updates = CounterUpdates();
+#endif
+        SharedPtr<Derived> derived;
+        EXPECT_ZERO_ALLOCATIONS(derived = StaticPointerCast<Derived>(std::move(base)));
+        REQUIRE(!base);
+        REQUIRE(base.UseCount() == 0);
+        REQUIRE(derived.Get() == raw);
+        REQUIRE(derived.UseCount() == 1);
+
+        SharedPtr<const Derived> constant = std::move(derived);
+        derived = ConstPointerCast<Derived>(std::move(constant));
+        REQUIRE(!constant);
+        REQUIRE(constant.UseCount() == 0);
+        REQUIRE(derived.UseCount() == 1);
+
+        base = DynamicPointerCast<Base>(std::move(derived));
+        REQUIRE(!derived);
+        REQUIRE(derived.UseCount() == 0);
+        REQUIRE(base.Get() == raw);
+        REQUIRE(base.UseCount() == 1);
+
+        SharedPtr<char> bytes = ReinterpretPointerCast<char>(std::move(base));
+        REQUIRE(!base);
+        REQUIRE(base.UseCount() == 0);
+        REQUIRE(bytes.Get() == reinterpret_cast<char*>(raw));
+        REQUIRE(bytes.UseCount() == 1);
+#ifdef SW_COUNTING_COUNTERS
+        REQUIRE(CounterUpdates() == updates);
+#endif
+    }
+
+    SECTION("Failed dynamic cast keeps the source") {
+        Base* raw = base.Get();
+        SharedPtr<Base> other_owner = base;
+#ifdef SW_COUNTING_COUNTERS
+        auto updates = CounterUpdates();
+#endif
+        SharedPtr<Other> other = DynamicPointerCast<Other>(std::move(base));
+        REQUIRE(!other);
+        REQUIRE(other.UseCount() == 0);
+        REQUIRE(base.Get() == raw);
+        REQUIRE(base.UseCount() == 2);
+        REQUIRE(base == other_owner);
+#ifdef SW_COUNTING_COUNTERS
+        REQUIRE(CounterUpdates() == updates);
+#endif
+    }
+
+    SECTION("Aliasing a member") {
+        SharedPtr<Data> data(new Data{42, 3.14});
+        double* member = &data->y;
+#ifdef SW_COUNTING_COUNTERS
+        auto updates = CounterUpdates();
+#endif
+        SharedPtr<double> y(std::move(data), member);
+        REQUIRE(data.Get() == nullptr);
+        REQUIRE(*y == 3.14);
+        REQUIRE(y.UseCount() == 1);
+#ifdef SW_COUNTING_COUNTERS
+        REQUIRE(CounterUpdates() == updates);
+#endif
+    }
+}
+
 struct A {
     ~A() = default;
 };
@@ -467,3 +578,594 @@ TEST_CASE("Destructor for correct type") {
         REQUIRE(B::destructor_called);
     }
 }
+
+struct CountingDeleter {
+    int* calls;
+
+    void operator()(int* p) const {
+        ++*calls;
+        delete p;
+    }
+};
+
+struct EmptyDeleter {
+    void operator()(int* p) const {
+        delete p;
+    }
+};
+
+template <typename T>
+struct FailingAllocator {
+    using value_type = T;
+
+    FailingAllocator() = default;
+
+    template <typename U>
+    FailingAllocator(const FailingAllocator<U>&) {
+    }
+
+    T* allocate(size_t) {
+        throw std::bad_alloc();
+    }
+
+    void deallocate(T*, size_t) {
+    }
+};
+
+TEST_CASE("Custom deleter") {
+    SECTION("Called once by the last owner") {
+        int calls = 0;
+        {
+            SharedPtr<int> sp(new int(42), CountingDeleter{&calls});
+            auto sp2 = sp;
+            sp.Reset();
+            REQUIRE(calls == 0);
+            REQUIRE(*sp2 == 42);
+        }
+        REQUIRE(calls == 1);
+    }
+
+    SECTION("Object not from new") {
+        int x = 42;
+        bool called = false;
+        {
+            SharedPtr<int> sp(&x, [&called](int*) { called = true; });
+            REQUIRE(*sp == 42);
+        }
+        REQUIRE(called);
+    }
+
+    SECTION("Stateless deleter takes no space") {
+        static_assert(sizeof(ControlBlockDeleter<int, EmptyDeleter>) ==
+                      sizeof(ControlBlock1<int>));
+        REQUIRE(sizeof(ControlBlockDeleter<int, CountingDeleter>) > sizeof(ControlBlock1<int>));
+    }
+
+    SECTION("One allocation") {
+        int* raw = new int(42);
+        EXPECT_ONE_ALLOCATION(SharedPtr<int>(raw, EmptyDeleter{}));
+    }
+
+    SECTION("Reset") {
+        int calls = 0;
+        SharedPtr<int> sp(new int(1));
+        sp.Reset(new int(2), CountingDeleter{&calls});
+        REQUIRE(*sp == 2);
+        sp.Reset();
+        REQUIRE(calls == 1);
+    }
+
+    SECTION("Allocator") {
+        int calls = 0;
+        {
+            SharedPtr<int> sp(new int(1), CountingDeleter{&calls}, std::allocator<int>());
+            REQUIRE(GetDeleter<CountingDeleter>(sp)->calls == &calls);
+            sp.Reset(new int(2), CountingDeleter{&calls}, std::allocator<int>());
+            REQUIRE(calls == 1);
+            REQUIRE(*sp == 2);
+        }
+        REQUIRE(calls == 2);
+
+        REQUIRE_THROWS_AS(SharedPtr<int>(new int(3), CountingDeleter{&calls},
+                                         FailingAllocator<int>()),
+                          std::bad_alloc);
+        REQUIRE(calls == 3);
+    }
+
+    SECTION("Correct type") {
+        B::destructor_called = false;
+        { SharedPtr<A> sp(new B, [](B* p) { delete p; }); }
+        REQUIRE(B::destructor_called);
+    }
+}
+
+TEST_CASE("GetDeleter") {
+    int calls = 0;
+    SharedPtr<int> sp(new int(42), CountingDeleter{&calls});
+
+    auto deleter = GetDeleter<CountingDeleter>(sp);
+    REQUIRE(deleter != nullptr);
+    REQUIRE(deleter->calls == &calls);
+    REQUIRE(GetDeleter<CountingDeleter>(SharedPtr<const int>(sp)) == deleter);
+
+    REQUIRE(GetDeleter<EmptyDeleter>(sp) == nullptr);
+    REQUIRE(GetDeleter<CountingDeleter>(SharedPtr<int>()) == nullptr);
+    REQUIRE(GetDeleter<CountingDeleter>(SharedPtr<int>(new int(1))) == nullptr);
+    REQUIRE(GetDeleter<CountingDeleter>(MakeShared<int>(1)) == nullptr);
+}
+
+TEST_CASE("From UniquePtr") {
+    SECTION("Deleter is kept") {
+        int calls = 0;
+        UniquePtr<int, CountingDeleter> unique(new int(42), CountingDeleter{&calls});
+        {
+            SharedPtr<int> sp(std::move(unique));
+            REQUIRE(unique.Get() == nullptr);
+            REQUIRE(*sp == 42);
+            REQUIRE(sp.UseCount() == 1);
+            REQUIRE(GetDeleter<CountingDeleter>(sp)->calls == &calls);
+            REQUIRE(calls == 0);
+        }
+        REQUIRE(calls == 1);
+    }
+
+    SECTION("Move-only deleter") {
+        UniquePtr<int, Deleter<int>> unique(new int(42), Deleter<int>(7));
+        SharedPtr<const int> sp = std::move(unique);
+        REQUIRE(GetDeleter<Deleter<int>>(sp)->GetTag() == 7);
+    }
+
+    SECTION("Array") {
+        UniquePtr<int[]> unique(new int[3]{1, 2, 3});
+        SharedPtr<int[]> sp(std::move(unique));
+        REQUIRE(sp[2] == 3);
+    }
+
+    SECTION("Empty") {
+        UniquePtr<int> unique;
+        EXPECT_ZERO_ALLOCATIONS(SharedPtr<int>(std::move(unique)));
+        REQUIRE(SharedPtr<int>(UniquePtr<int>()).UseCount() == 0);
+    }
+
+    SECTION("One allocation") {
+        UniquePtr<int, EmptyDeleter> unique(new int(42));
+        EXPECT_ONE_ALLOCATION(SharedPtr<int>(std::move(unique)));
+    }
+
+    SECTION("Shareable") {
+        auto unique = MakeShareableUnique<int>(42);
+        *unique += 1;
+        SharedPtr<int> sp;
+        EXPECT_ZERO_ALLOCATIONS(sp = std::move(unique));
+        REQUIRE(unique.Get() == nullptr);
+        REQUIRE(*sp == 43);
+        REQUIRE(sp.UseCount() == 1);
+
+        auto copy = sp;
+        REQUIRE(copy.UseCount() == 2);
+    }
+
+    SECTION("Shareable, never shared") {
+        B::destructor_called = false;
+        { auto unique = MakeShareableUnique<B>(); }
+        REQUIRE(B::destructor_called);
+    }
+}
+
+struct ArenaStats {
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    size_t bytes = 0;
+};
+
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    explicit ArenaAllocator(ArenaStats* stats) : stats(stats) {
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : stats(other.stats) {
+    }
+
+    T* allocate(size_t n) {
+        ++stats->allocations;
+        stats->bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        ++stats->deallocations;
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    ArenaStats* stats;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& left, const ArenaAllocator<U>& right) {
+    return left.stats == right.stats;
+}
+
+TEST_CASE("AllocateShared") {
+    SECTION("One allocation") {
+        EXPECT_ONE_ALLOCATION(REQUIRE(*AllocateShared<int>(std::allocator<int>(), 42) == 42));
+    }
+
+    SECTION("Stateless allocator takes no space") {
+        static_assert(sizeof(ControlBlockAlloc<int, std::allocator<int>>) ==
+                      sizeof(ControlBlock2<int>));
+    }
+
+    SECTION("Through the allocator") {
+        ArenaStats stats;
+        {
+            auto sp = AllocateShared<Data>(ArenaAllocator<char>(&stats), 42, 3.14);
+            auto sp2 = sp;
+            REQUIRE(sp2->x == 42);
+            REQUIRE(stats.allocations == 1);
+            REQUIRE(stats.bytes >= sizeof(Data));
+        }
+        REQUIRE(stats.deallocations == 1);
+    }
+
+    SECTION("Correct type") {
+        B::destructor_called = false;
+        { SharedPtr<A> ptr = AllocateShared<B>(std::allocator<B>()); }
+        REQUIRE(B::destructor_called);
+    }
+
+    SECTION("Faulty constructor") {
+        ArenaStats stats;
+        REQUIRE_THROWS(AllocateShared<Throwing>(ArenaAllocator<Throwing>(&stats)));
+        REQUIRE(stats.allocations == 1);
+        REQUIRE(stats.deallocations == 1);
+    }
+}
+
+struct Element {
+    static inline std::vector<int> destroyed;
+    static inline int throw_at = -1;
+    static inline int built = 0;
+
+    Element() : Element(0) {
+    }
+
+    Element(int value) : tag(value == 0 ? built : value) {
+        if (built == throw_at) {
+            throw 42;
+        }
+        ++built;
+    }
+
+    Element(const Element& other) : Element(other.tag) {
+    }
+
+    ~Element() {
+        destroyed.push_back(tag);
+    }
+
+    int tag;
+};
+
+TEST_CASE("Arrays") {
+    SECTION("One allocation") {
+        EXPECT_ONE_ALLOCATION({
+            auto sp = MakeShared<int[]>(1000);
+            REQUIRE(sp[0] == 0);
+            REQUIRE(sp[999] == 0);
+        });
+    }
+
+    SECTION("Value") {
+        auto sp = MakeShared<double[]>(3, 2.5);
+        REQUIRE(sp[0] == 2.5);
+        REQUIRE(sp[2] == 2.5);
+
+        auto fixed = MakeShared<int[4]>(7);
+        REQUIRE(fixed[3] == 7);
+
+        auto empty = MakeShared<int[]>(0);
+        REQUIRE(empty);
+    }
+
+    SECTION("Reverse destruction") {
+        Element::destroyed.clear();
+        Element::built = 0;
+        Element::throw_at = -1;
+        { auto sp = MakeShared<Element[]>(3); }
+        REQUIRE(Element::destroyed == std::vector<int>{2, 1, 0});
+
+        Element::destroyed.clear();
+        Element::built = 0;
+        { auto sp = MakeShared<Element[3]>(); }
+        REQUIRE(Element::destroyed == std::vector<int>{2, 1, 0});
+    }
+
+    SECTION("Faulty constructor") {
+        Element::destroyed.clear();
+        Element::built = 0;
+        Element::throw_at = 2;
+        REQUIRE_THROWS(MakeShared<Element[]>(5));
+        REQUIRE(Element::destroyed == std::vector<int>{1, 0});
+        Element::throw_at = -1;
+    }
+
+    SECTION("Alignment") {
+        struct alignas(64) Line {
+            char data[64];
+        };
+        auto sp = MakeShared<Line[]>(3);
+        REQUIRE(reinterpret_cast<uintptr_t>(sp.Get()) % 64 == 0);
+    }
+
+    SECTION("From new[]") {
+        SharedPtr<int[]> sp(new int[3]{1, 2, 3});
+        auto sp2 = sp;
+        REQUIRE(sp2[2] == 3);
+
+        sp.Reset(new int[2]{4, 5});
+        REQUIRE(sp[1] == 5);
+    }
+
+    SECTION("Conversions") {
+        SharedPtr<int[]> sp = MakeShared<int[]>(2, 1);
+        SharedPtr<const int[]> csp = sp;
+        REQUIRE(csp.UseCount() == 2);
+        REQUIRE(csp[1] == 1);
+
+        SharedPtr<int> first(sp, &sp[0]);
+        REQUIRE(*first == 1);
+    }
+}
+
+struct Counted {
+    static inline int constructed = 0;
+
+    Counted() {
+        ++constructed;
+    }
+
+    int value = 42;
+};
+
+TEST_CASE("MakeSharedForOverwrite") {
+    SECTION("One allocation") {
+#ifdef SW_CACHED_BLOCKS
+        { auto warm_up = MakeSharedForOverwrite<int>(); }
+        EXPECT_ZERO_ALLOCATIONS(MakeSharedForOverwrite<int>());
+#else
+        EXPECT_ONE_ALLOCATION(MakeSharedForOverwrite<int>());
+#endif
+        EXPECT_ONE_ALLOCATION(MakeSharedForOverwrite<char[]>(1 << 20));
+        EXPECT_ONE_ALLOCATION(MakeSharedForOverwrite<char[64]>());
+    }
+
+    SECTION("Default constructors still run") {
+        Counted::constructed = 0;
+        REQUIRE(MakeSharedForOverwrite<Counted>()->value == 42);
+        REQUIRE(MakeSharedForOverwrite<Counted[]>(3)[2].value == 42);
+        REQUIRE(MakeSharedForOverwrite<Counted[2]>()[1].value == 42);
+        REQUIRE(Counted::constructed == 6);
+    }
+
+    SECTION("Writable") {
+        auto buffer = MakeSharedForOverwrite<char[]>(16);
+        for (size_t i = 0; i < 16; ++i) {
+            buffer[i] = static_cast<char>(i);
+        }
+        REQUIRE(buffer[15] == 15);
+    }
+}
+
+TEST_CASE("MakeSharedPadded") {
+    SECTION("Object on its own cache line") {
+        auto shared = MakeSharedPadded<int>(42);
+        REQUIRE(*shared == 42);
+        REQUIRE(reinterpret_cast<uintptr_t>(shared.Get()) % kCacheLineSize == 0);
+        REQUIRE(sizeof(ControlBlock2<int, true>) == 2 * kCacheLineSize);
+    }
+
+    SECTION("Copies and destruction") {
+        Counted::constructed = 0;
+        auto shared = MakeSharedPadded<Counted>();
+        auto copy = shared;
+        REQUIRE(copy.UseCount() == 2);
+        shared.Reset();
+        REQUIRE(copy->value == 42);
+        REQUIRE(Counted::constructed == 1);
+    }
+}
+
+struct Hot {
+    ~Hot() {
+        ++destroyed;
+    }
+
+    int value = 0;
+
+    static inline int destroyed = 0;
+};
+
+template <>
+inline constexpr bool kStrongOnly<Hot> = true;
+
+TEST_CASE("Strong-only types") {
+    static_assert(std::is_same_v<BlockFor<Hot>, StrongBlock>);
+    static_assert(std::is_same_v<BlockFor<const Hot[]>, StrongBlock>);
+    static_assert(sizeof(StrongBlock) == sizeof(void*) + sizeof(size_t));
+    static_assert(sizeof(StrongBlock) <= sizeof(BaseBlock));
+    static_assert(sizeof(ControlBlock1<Hot>) <= sizeof(ControlBlock1<int>));
+
+    SECTION("MakeShared") {
+        Hot::destroyed = 0;
+        {
+            auto sp = MakeShared<Hot>(Hot{42});
+            SharedPtr<const Hot> copy = sp;
+            REQUIRE(copy->value == 42);
+            REQUIRE(sp.UseCount() == 2);
+            sp.Reset();
+            REQUIRE(copy.UseCount() == 1);
+            REQUIRE(Hot::destroyed == 1);  // the temporary
+        }
+        REQUIRE(Hot::destroyed == 2);
+    }
+
+    SECTION("Other blocks") {
+        Hot::destroyed = 0;
+        {
+            SharedPtr<Hot> raw(new Hot);
+            int calls = 0;
+            SharedPtr<Hot> deleted(new Hot, [&calls](Hot* p) {
+                ++calls;
+                delete p;
+            });
+            auto array = MakeShared<Hot[]>(3);
+            auto allocated = AllocateShared<Hot>(std::allocator<Hot>());
+            auto cast = StaticPointerCast<const Hot>(std::move(raw));
+            REQUIRE(cast.UseCount() == 1);
+        }
+        REQUIRE(Hot::destroyed == 6);
+    }
+}
+
+TEST_CASE("TryUnwrap") {
+    SECTION("Only owner") {
+        auto sp = MakeShared<std::vector<int>>(3, 7);
+        const int* data = sp->data();
+        auto unique = TryUnwrap(std::move(sp));
+        REQUIRE(sp.Get() == nullptr);
+        REQUIRE(unique->data() == data);
+        unique->push_back(8);
+        REQUIRE(unique->size() == 4);
+    }
+
+    SECTION("Shared") {
+        auto sp = MakeShared<int>(42);
+        auto copy = sp;
+        REQUIRE(TryUnwrap(std::move(sp)).Get() == nullptr);
+        REQUIRE(*sp == 42);
+        REQUIRE(sp.UseCount() == 2);
+
+        copy.Reset();
+        REQUIRE(*TryUnwrap(std::move(sp)) == 42);
+    }
+
+    SECTION("Empty") {
+        REQUIRE(TryUnwrap(SharedPtr<int>()).Get() == nullptr);
+    }
+
+    SECTION("Destroyed by the UniquePtr") {
+        int calls = 0;
+        {
+            auto unique = TryUnwrap(SharedPtr<int>(new int(1), CountingDeleter{&calls}));
+            REQUIRE(calls == 0);
+        }
+        REQUIRE(calls == 1);
+
+        Hot::destroyed = 0;
+        { auto unique = TryUnwrap(MakeShared<Hot>()); }
+        REQUIRE(Hot::destroyed == 1);
+
+        auto array = TryUnwrap(MakeShared<int[]>(3, 5));
+        REQUIRE(array[2] == 5);
+    }
+}
+
+TEST_CASE("Slab") {
+    SECTION("Freed slots are reused") {
+        void* first = Slab::Allocate(24);
+        Slab::Deallocate(first, 24);
+        auto before = Slab::GetStats(24);
+        void* second = Slab::Allocate(32);
+        REQUIRE(second == first);
+        REQUIRE(Slab::GetStats(32).refills == before.refills);
+        Slab::Deallocate(second, 32);
+    }
+
+    SECTION("AllocateShared with SlabAllocator") {
+        // Make sure the size class has free slots, so that no chunk is needed
+        SlabAllocator<int> alloc;
+        { auto warm_up = AllocateShared<int>(alloc, 0); }
+
+        auto before = Slab::GetStats();
+        EXPECT_ZERO_ALLOCATIONS(REQUIRE(*AllocateShared<int>(alloc, 42) == 42));
+        auto after = Slab::GetStats();
+        REQUIRE(after.allocations == before.allocations + 1);
+        REQUIRE(after.InUse() == before.InUse());
+    }
+
+    SECTION("SharedPtr(ptr, deleter, SlabAllocator)") {
+        SlabAllocator<int> alloc;
+        { SharedPtr<int> warm_up(new int(0), EmptyDeleter{}, alloc); }
+
+        int* raw = new int(42);
+        auto before = Slab::GetStats();
+        {
+            SharedPtr<int> sp;
+            EXPECT_ZERO_ALLOCATIONS(sp = SharedPtr<int>(raw, EmptyDeleter{}, alloc));
+            REQUIRE(*sp == 42);
+            REQUIRE(Slab::GetStats().InUse() == before.InUse() + 1);
+        }
+        REQUIRE(Slab::GetStats().InUse() == before.InUse());
+    }
+
+    SECTION("Large requests bypass the slab") {
+        auto before = Slab::GetStats();
+        struct Large {
+            char data[1024];
+        };
+        auto shared = AllocateShared<Large>(SlabAllocator<Large>());
+        REQUIRE(Slab::GetStats().allocations == before.allocations);
+    }
+}
+
+TEST_CASE("BlockCache") {
+    SECTION("AllocateShared with BlockCacheAllocator") {
+        // The thread's cache already has a run for this size
+        BlockCacheAllocator<int> alloc;
+        { auto warm_up = AllocateShared<int>(alloc, 0); }
+
+        auto before = BlockCache::GetStats();
+        {
+            SharedPtr<int> sp;
+            EXPECT_ZERO_ALLOCATIONS(sp = AllocateShared<int>(alloc, 42));
+            REQUIRE(*sp == 42);
+            REQUIRE(BlockCache::GetStats().allocations == before.allocations + 1);
+        }
+        REQUIRE(BlockCache::GetStats().deallocations == before.deallocations + 1);
+        REQUIRE(BlockCache::GetStats().runs == before.runs);
+    }
+
+    SECTION("Only on request") {
+        auto before = BlockCache::GetStats().allocations;
+        auto made = MakeShared<int>(42);
+        SharedPtr<int> owned(new int(42));
+#ifdef SW_CACHED_BLOCKS
+        REQUIRE(BlockCache::GetStats().allocations == before + 2);
+#else
+        REQUIRE(BlockCache::GetStats().allocations == before);
+#endif
+    }
+
+    SECTION("Freed blocks are reused") {
+        BlockCacheAllocator<int> alloc;
+        auto first = AllocateShared<int>(alloc, 1);
+        auto address = first.Get();
+        first.Reset();
+        auto second = AllocateShared<int>(alloc, 2);
+        REQUIRE(second.Get() == address);
+    }
+
+    SECTION("Large and over-aligned blocks bypass the cache") {
+        struct alignas(64) Aligned {
+            int value;
+        };
+        auto before = BlockCache::GetStats().allocations;
+        auto large = AllocateShared<std::array<char, 1024>>(
+            BlockCacheAllocator<std::array<char, 1024>>());
+        auto aligned = AllocateShared<Aligned>(BlockCacheAllocator<Aligned>());
+        REQUIRE(BlockCache::GetStats().allocations == before);
+    }
+}
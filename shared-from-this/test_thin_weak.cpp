@@ -0,0 +1,100 @@
+#include "thin_weak.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <memory>
+#include <string>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("ThinWeakPtr basics") {
+    SECTION("One word") {
+        static_assert(sizeof(ThinWeakPtr<int>) == sizeof(void*));
+    }
+
+    SECTION("Empty") {
+        ThinWeakPtr<int> a;
+        ThinWeakPtr<int> b(SharedPtr<int>{});
+        a = b;
+        REQUIRE(a.Expired());
+        REQUIRE(a.Lock().Get() == nullptr);
+    }
+
+    SECTION("Copy/move") {
+        auto shared = MakeShared<std::string>("aba");
+        ThinWeakPtr<std::string> a(shared);
+        ThinWeakPtr<std::string> b(a);
+        ThinWeakPtr<std::string> c(std::move(a));
+        REQUIRE(a.Expired());
+        REQUIRE(*b.Lock() == "aba");
+        REQUIRE(*c.Lock() == "aba");
+        shared.Reset();
+        REQUIRE(b.Expired());
+        REQUIRE(c.Lock().Get() == nullptr);
+    }
+
+    SECTION("No allocations") {
+        auto shared = MakeShared<int>(42);
+        EXPECT_ZERO_ALLOCATIONS(ThinWeakPtr<int>{shared});
+    }
+}
+
+struct ThinBase {
+    int base = 1;
+};
+
+struct ThinDerived : ThinBase {
+    int derived = 2;
+};
+
+struct Unrelated {
+    virtual ~Unrelated() = default;
+    int unrelated = 3;
+};
+
+struct ThinMulti : Unrelated, ThinBase {};
+
+TEST_CASE("ThinWeakPtr::Lock gives the same pointer") {
+    auto check = [](const auto& shared) {
+        using T = typename std::decay_t<decltype(shared)>::element_type;
+        ThinWeakPtr<T> weak(shared);
+        auto locked = weak.Lock();
+        REQUIRE(locked.Get() == shared.Get());
+        REQUIRE(locked.UseCount() == shared.UseCount());
+    };
+
+    SECTION("Every kind of block") {
+        check(MakeShared<int>(1));
+        check(SharedPtr<int>(new int(2)));
+        check(SharedPtr<int>(new int(3), std::default_delete<int>()));
+        check(AllocateShared<int>(std::allocator<int>(), 4));
+        check(MakeSharedPadded<int>(5));
+        check(MakeSharedSplit<int>(6));
+        check(SharedPtr<const int>(new int(7)));
+    }
+
+    SECTION("Arrays") {
+        auto array = MakeShared<int[]>(3, 7);
+        ThinWeakPtr<int[]> weak(array);
+        REQUIRE(weak.Lock()[2] == 7);
+        check(MakeShared<int[4]>());
+        check(SharedPtr<int[]>(new int[5]));
+    }
+
+    SECTION("Base at offset zero") {
+        SharedPtr<ThinBase> base = MakeShared<ThinDerived>();
+        check(base);
+    }
+
+    SECTION("Lost pointers are rejected") {
+        SharedPtr<ThinBase> base = MakeShared<ThinMulti>();
+        REQUIRE_THROWS_AS(ThinWeakPtr<ThinBase>(base), BadThinWeakPtr);
+
+        auto derived = MakeShared<ThinDerived>();
+        SharedPtr<int> alias(derived, &derived->derived);
+        REQUIRE_THROWS_AS(ThinWeakPtr<int>(alias), BadThinWeakPtr);
+        REQUIRE(derived.UseCount() == 2);
+    }
+}
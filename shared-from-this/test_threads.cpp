@@ -0,0 +1,299 @@
+#include "block_cache.h"
+#include "cow.h"
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static_assert(BlockCounters::kThreadSafe);
+
+struct Tracked {
+    static inline std::atomic<int> alive = 0;
+
+    explicit Tracked(int value) : value(value) {
+        ++alive;
+    }
+
+    ~Tracked() {
+        --alive;
+    }
+
+    int value;
+};
+
+// Biased counters leave some objects for their creator thread to destroy
+int Alive() {
+    BlockCounters::CollectDeferred();
+    return Tracked::alive;
+}
+
+TEST_CASE("Hand over to another thread") {
+    SECTION("Moved away") {
+        auto sp = MakeShared<Tracked>(1);
+        std::thread([sp = std::move(sp)]() mutable { sp.Reset(); }).join();
+        REQUIRE(Alive() == 0);
+    }
+
+    SECTION("Copies outlive the creator's") {
+        SharedPtr<Tracked> sp(new Tracked(2));
+        WeakPtr<Tracked> wp(sp);
+        int seen = 0;
+        std::thread consumer([copy = sp, &seen]() mutable {
+            seen = copy->value;
+            copy.Reset();
+        });
+        sp.Reset();
+        consumer.join();
+
+        REQUIRE(seen == 2);
+
+        REQUIRE(wp.Lock().Get() == nullptr);
+        REQUIRE(Alive() == 0);
+    }
+
+    SECTION("Creator exits first") {
+        SharedPtr<Tracked> sp;
+        std::thread([&sp] {
+            auto local = MakeShared<Tracked>(3);
+            sp = local;
+        }).join();
+
+        REQUIRE(sp.UseCount() == 1);
+        REQUIRE(sp->value == 3);
+        sp.Reset();
+        REQUIRE(Alive() == 0);
+    }
+}
+
+TEST_CASE("TryUnwrap in another thread") {
+    SECTION("Sole owner") {
+        auto sp = MakeShared<Tracked>(4);
+        Tracked* raw = sp.Get();
+        bool unwrapped = false;
+        std::thread([sp = std::move(sp), raw, &unwrapped]() mutable {
+            auto unique = TryUnwrap(std::move(sp));
+            unwrapped = unique.Get() == raw;
+        }).join();
+        REQUIRE(unwrapped);
+        REQUIRE(Alive() == 0);
+    }
+
+    SECTION("Last owner after a race") {
+        auto sp = MakeShared<Tracked>(5);
+        std::thread([copy = sp]() mutable { copy.Reset(); }).join();
+        BlockCounters::CollectDeferred();
+        REQUIRE(TryUnwrap(std::move(sp))->value == 5);
+        REQUIRE(Alive() == 0);
+    }
+}
+
+#ifndef SW_BIASED_COUNTERS
+
+TEST_CASE("CowPtr snapshots in other threads") {
+    constexpr int kReaders = 4;
+    constexpr int kEdits = 1'000;
+
+    auto document = MakeCow<std::vector<int>>(16, 0);
+    std::vector<std::thread> readers;
+    std::atomic<bool> consistent = true;
+    for (int i = 0; i < kReaders; ++i) {
+        // Every snapshot must stay as it was taken while the writer goes on
+        readers.emplace_back([&consistent, snapshot = document] {
+            for (int round = 0; round < kEdits; ++round) {
+                for (int value : snapshot.Read()) {
+                    if (value != 0) {
+                        consistent = false;
+                    }
+                }
+            }
+        });
+    }
+    for (int edit = 0; edit < kEdits; ++edit) {
+        for (int& value : document.Write()) {
+            ++value;
+        }
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    REQUIRE(consistent);
+    BlockCounters::CollectDeferred();
+    REQUIRE(document.UseCount() == 1);
+    REQUIRE(document.Read()[0] == kEdits);
+}
+
+#endif
+
+TEST_CASE("Many threads, one object") {
+    constexpr int kThreads = 8;
+    constexpr int kCopies = 10'000;
+
+    {
+        auto sp = MakeShared<Tracked>(4);
+        WeakPtr<Tracked> wp(sp);
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([&, i] {
+                std::vector<SharedPtr<Tracked>> copies;
+                for (int j = 0; j < kCopies; ++j) {
+                    if ((i + j) % 2 == 0) {
+                        copies.push_back(sp);
+                    } else {
+                        copies.push_back(wp.Lock());
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        REQUIRE(sp.UseCount() == 1);
+        REQUIRE(wp.UseCount() == 1);
+    }
+
+    REQUIRE(Alive() == 0);
+}
+
+TEST_CASE("Last owners race") {
+    std::atomic<bool> broken = false;
+    for (int i = 0; i < 1'000; ++i) {
+        auto sp = MakeShared<Tracked>(i);
+        WeakPtr<Tracked> wp(sp);
+
+        std::thread first([copy = sp]() mutable { copy.Reset(); });
+        std::thread second([copy = sp]() mutable { copy.Reset(); });
+        std::thread observer([wp, i, &broken]() mutable {
+            if (auto locked = wp.Lock(); locked && locked->value != i) {
+                broken = true;
+            }
+            wp.Reset();
+        });
+        sp.Reset();
+
+        first.join();
+        second.join();
+        observer.join();
+        BlockCounters::CollectDeferred();
+        REQUIRE(wp.Expired());
+    }
+
+    REQUIRE(!broken);
+    REQUIRE(Alive() == 0);
+}
+
+// In the biased mode the owner merges its count when its last copy goes away. A copy taken by
+// another thread may then drop the last reference and free the block right after the merge
+TEST_CASE("Owner reset against a remote release") {
+    for (int i = 0; i < 2'000; ++i) {
+        auto sp = MakeShared<Tracked>(i);
+        std::atomic<bool> copied = false;
+        std::atomic<bool> go = false;
+        std::thread remote([&] {
+            SharedPtr<Tracked> copy = sp;
+            copied.store(true, std::memory_order_release);
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            copy.Reset();
+        });
+        while (!copied.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        go.store(true, std::memory_order_release);
+        sp.Reset();
+        remote.join();
+        BlockCounters::CollectDeferred();
+    }
+    REQUIRE(Alive() == 0);
+}
+
+// Created before the thread touches the slab, so destroyed after the slab has taken the thread's
+// slots back
+struct LateSlabUser {
+    ~LateSlabUser() {
+        Slab::Deallocate(Slab::Allocate(24), 24);
+    }
+};
+
+TEST_CASE("Slab lists of exiting threads") {
+    auto before = Slab::GetStats(24);
+    std::thread([] {
+        static thread_local LateSlabUser late;
+        std::vector<void*> slots;
+        for (size_t i = 0; i < 3 * Slab::kBatchSize; ++i) {
+            slots.push_back(Slab::Allocate(24));
+        }
+        for (void* slot : slots) {
+            Slab::Deallocate(slot, 24);
+        }
+    }).join();
+
+    auto after = Slab::GetStats(24);
+    REQUIRE(after.allocations == before.allocations + 3 * Slab::kBatchSize + 1);
+    REQUIRE(after.InUse() == before.InUse());
+}
+
+// Created before the thread gets a block cache, so destroyed after the cache is parked
+struct LateCacheUser {
+    ~LateCacheUser() {
+        auto block = AllocateShared<int>(BlockCacheAllocator<int>(), 42);
+        auto other = AllocateShared<int>(BlockCacheAllocator<int>(), 43);
+        // From the orphan cache: the thread does not get a new one of its own
+        ok = *block == 42 && *other == 43 && BlockCache::GetStats().allocations == 0;
+    }
+
+    static inline std::atomic<bool> ok = false;
+};
+
+TEST_CASE("Block cache of an exiting thread") {
+    std::thread([] {
+        static thread_local LateCacheUser late;
+        auto block = AllocateShared<int>(BlockCacheAllocator<int>(), 1);
+    }).join();
+    REQUIRE(LateCacheUser::ok);
+}
+
+// The producer/consumer case: with `SW_CACHED_BLOCKS` it is plain `MakeShared`
+SharedPtr<Tracked> Produce(int value) {
+#ifdef SW_CACHED_BLOCKS
+    return MakeShared<Tracked>(value);
+#else
+    return AllocateShared<Tracked>(BlockCacheAllocator<Tracked>(), value);
+#endif
+}
+
+TEST_CASE("Blocks freed by another thread") {
+    constexpr int kBlocks = 1'000;
+
+    BlockCache::Collect();
+    auto before = BlockCache::GetStats();
+
+    std::vector<SharedPtr<Tracked>> produced;
+    for (int i = 0; i < kBlocks; ++i) {
+        produced.push_back(Produce(i));
+    }
+    std::thread([produced = std::move(produced)]() mutable { produced.clear(); }).join();
+    REQUIRE(Alive() == 0);
+
+    BlockCache::Collect();
+    auto after = BlockCache::GetStats();
+    REQUIRE(after.allocations == before.allocations + kBlocks);
+    // With biased counters the objects are destroyed, and the blocks freed, by this thread
+    REQUIRE(after.deallocations + after.remote_deallocations ==
+            before.deallocations + before.remote_deallocations + kBlocks);
+
+    // The producer gets its blocks back without new runs
+    for (int i = 0; i < kBlocks; ++i) {
+        produced.push_back(Produce(i));
+    }
+    REQUIRE(BlockCache::GetStats().runs == after.runs);
+}
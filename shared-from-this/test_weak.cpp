@@ -175,3 +175,136 @@ TEST_CASE("Lifetimes") {
         delete wp;
     }
 }
+
+template <typename T>
+struct CountingAllocator : std::allocator<T> {
+    static inline size_t deallocations = 0;
+
+    CountingAllocator() = default;
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>&) {
+    }
+
+    template <typename U>
+    struct rebind {
+        using other = CountingAllocator<U>;
+    };
+
+    void deallocate(T* p, size_t n) {
+        ++CountingAllocator<char>::deallocations;
+        std::allocator<T>::deallocate(p, n);
+    }
+};
+
+TEST_CASE("AllocateShared outlived by Weak") {
+    CountingAllocator<char>::deallocations = 0;
+    WeakPtr<MyInt> weak;
+    {
+        auto shared = AllocateShared<MyInt>(CountingAllocator<MyInt>(), 42);
+        weak = shared;
+    }
+    REQUIRE(weak.Expired());
+    REQUIRE(MyInt::AliveCount() == 0);
+    REQUIRE(CountingAllocator<char>::deallocations == 0);
+
+    weak.Reset();
+    REQUIRE(CountingAllocator<char>::deallocations == 1);
+}
+
+// Counts its own storage, which `MakeShared` puts into the control block instead
+struct Large {
+    static inline int allocated = 0;
+
+    static void* operator new(size_t size) {
+        ++allocated;
+        return ::operator new(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) noexcept {
+        --allocated;
+        ::operator delete(ptr, size);
+    }
+
+    char data[4096] = {};
+};
+
+TEST_CASE("MakeSharedSplit releases memory early") {
+    SECTION("One allocation keeps the object for the WeakPtr") {
+        CountingAllocator<char>::deallocations = 0;
+        auto shared = AllocateShared<Large>(CountingAllocator<Large>());
+        WeakPtr<Large> weak(shared);
+        shared.Reset();
+        REQUIRE(weak.Expired());
+        REQUIRE(CountingAllocator<char>::deallocations == 0);
+        weak.Reset();
+        REQUIRE(CountingAllocator<char>::deallocations == 1);
+        REQUIRE(Large::allocated == 0);
+    }
+
+    SECTION("MakeSharedSplit frees it with the last SharedPtr") {
+        auto shared = MakeSharedSplit<Large>();
+        WeakPtr<Large> weak(shared);
+        REQUIRE(Large::allocated == 1);
+        shared.Reset();
+        REQUIRE(weak.Expired());
+        REQUIRE(Large::allocated == 0);
+    }
+}
+
+TEST_CASE("MakeSharedSplit") {
+    SECTION("Object dies with the last SharedPtr") {
+        WeakPtr<MyInt> weak;
+        {
+            auto shared = MakeSharedSplit<MyInt>();
+            REQUIRE(MyInt::AliveCount() == 1);
+            weak = shared;
+        }
+        REQUIRE(weak.Expired());
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Arrays") {
+        auto shared = MakeSharedSplit<int[]>(3);
+        WeakPtr<int[]> weak(shared);
+        REQUIRE(shared[2] == 0);
+        shared[2] = 5;
+        REQUIRE(weak.Lock()[2] == 5);
+    }
+}
+
+struct Unobserved {
+    int value = 0;
+};
+
+template <>
+inline constexpr bool kStrongOnly<Unobserved> = true;
+
+// Declaring `WeakPtr` does not get in their way. Constructing one from them fails a
+// `static_assert`, which cannot be checked from here
+TEST_CASE("Strong-only types with WeakPtr around") {
+    static_assert(std::is_same_v<BlockFor<Unobserved>, StrongBlock>);
+    static_assert(std::is_same_v<BlockFor<const Unobserved>, StrongBlock>);
+
+    auto shared = MakeShared<Unobserved>();
+    SharedPtr<Unobserved> copy(shared);
+    copy = shared;
+    REQUIRE(shared.UseCount() == 2);
+
+    auto observed = MakeShared<MyInt>();
+    WeakPtr<MyInt> weak(observed);
+    REQUIRE(weak.Lock() == observed);
+}
+
+TEST_CASE("TryUnwrap expires WeakPtrs") {
+    auto shared = MakeShared<MyInt>();
+    WeakPtr<MyInt> weak(shared);
+    auto unique = TryUnwrap(std::move(shared));
+    REQUIRE(unique.Get() != nullptr);
+    REQUIRE(weak.Expired());
+    REQUIRE(weak.Lock().Get() == nullptr);
+    REQUIRE(MyInt::AliveCount() == 1);
+
+    unique.Reset();
+    REQUIRE(MyInt::AliveCount() == 0);
+}
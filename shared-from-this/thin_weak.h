@@ -0,0 +1,118 @@
+#pragma once
+
+#include "sw_fwd.h"  // Forward declaration
+
+#include "shared.h"
+
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+class BadThinWeakPtr : public std::exception {};
+
+// `WeakPtr` in a single word: only the control block is kept, and `Lock()` asks the block for
+// the object address. Locking costs one more indirect call, which suits weak references that are
+// held in bulk and rarely locked.
+template <typename T>
+class ThinWeakPtr {
+public:
+    using element_type = std::remove_extent_t<T>;
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Constructors
+
+    ThinWeakPtr() noexcept {
+    }
+
+    // Throws `BadThinWeakPtr` if `shared` does not point at the object owned by its block
+    // (aliasing, or a base class at a non-zero offset), since the pointer would be lost
+    ThinWeakPtr(const SharedPtr<T>& shared) {
+        static_assert(std::is_same_v<BlockFor<T>, BaseBlock>, "The type is declared strong-only");
+
+        if (shared.block_ == nullptr) {
+            return;
+        }
+        if (ObjectAddress(shared.ptr_) != shared.block_->GetObject()) {
+            throw BadThinWeakPtr();
+        }
+
+        block_ = shared.block_;
+        block_->IncWeak();
+    }
+
+    ThinWeakPtr(const ThinWeakPtr& other) noexcept {
+        block_ = other.block_;
+
+        if (block_ != nullptr) {
+            block_->IncWeak();
+        }
+    }
+
+    ThinWeakPtr(ThinWeakPtr&& other) noexcept {
+        Swap(other);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // `operator=`-s
+
+    ThinWeakPtr& operator=(const ThinWeakPtr& other) {
+        ThinWeakPtr(other).Swap(*this);
+        return *this;
+    }
+
+    ThinWeakPtr& operator=(ThinWeakPtr&& other) {
+        ThinWeakPtr(std::move(other)).Swap(*this);
+        return *this;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Destructor
+
+    ~ThinWeakPtr() {
+        if (block_ == nullptr) {
+            return;
+        }
+
+        if (block_->DecWeak() == 0) {
+            block_->Deallocate();
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Modifiers
+
+    void Reset() noexcept {
+        ThinWeakPtr().Swap(*this);
+    }
+
+    void Swap(ThinWeakPtr& other) noexcept {
+        std::swap(block_, other.block_);
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    size_t UseCount() const noexcept {
+        if (block_ == nullptr) {
+            return 0;
+        }
+
+        return block_->GetShared();
+    }
+
+    bool Expired() const noexcept {
+        return UseCount() == 0;
+    }
+
+    SharedPtr<T> Lock() const {
+        SharedPtr<T> shared;
+        if (block_ != nullptr && block_->TryIncShared()) {
+            shared.block_ = block_;
+            shared.ptr_ = static_cast<element_type*>(block_->GetObject());
+        }
+        return shared;
+    }
+
+private:
+    BaseBlock* block_ = nullptr;
+};
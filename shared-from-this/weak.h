@@ -13,6 +13,9 @@ class WeakPtr {
     template <typename Y>
     friend class SharedPtr;
 
+    template <typename Y>
+    friend class EmbeddedSharedFromThis;
+
 public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
@@ -54,6 +57,8 @@ public:
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
     WeakPtr(const SharedPtr<T>& other) {
+        static_assert(std::is_same_v<BlockFor<T>, BaseBlock>, "The type is declared strong-only");
+
         ptr_ = other.ptr_;
         block_ = other.block_;
 
@@ -64,6 +69,8 @@ public:
 
     template <class Y>
     WeakPtr(const SharedPtr<Y>& other) {
+        static_assert(std::is_same_v<BlockFor<Y>, BaseBlock>, "The type is declared strong-only");
+
         ptr_ = other.ptr_;
         block_ = other.block_;
 
@@ -105,10 +112,8 @@ public:
             return;
         }
 
-        block_->DecWeak();
-
-        if (block_->GetShared() == 0 && block_->GetWeak() == 0) {
-            delete block_;
+        if (block_->DecWeak() == 0) {
+            block_->Deallocate();
         }
     }
 
@@ -140,10 +145,15 @@ public:
     }
 
     SharedPtr<T> Lock() const {
-        return Expired() ? SharedPtr<T>() : SharedPtr<T>(*this);
+        SharedPtr<T> shared;
+        if (block_ != nullptr && block_->TryIncShared()) {
+            shared.block_ = block_;
+            shared.ptr_ = ptr_;
+        }
+        return shared;
     }
 
 private:
     BaseBlock* block_ = nullptr;
-    T* ptr_ = nullptr;
+    std::remove_extent_t<T>* ptr_ = nullptr;
 };
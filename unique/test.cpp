@@ -413,6 +413,26 @@ TEST_CASE("Array specialization") {
     }
 }
 
+TEST_CASE("MakeUniqueForOverwrite") {
+    SECTION("Single object") {
+        auto u = MakeUniqueForOverwrite<MyInt>();
+        REQUIRE(MyInt::AliveCount() == 1);
+        u.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Array") {
+        auto u = MakeUniqueForOverwrite<MyInt[]>(100);
+        REQUIRE(MyInt::AliveCount() == 100);
+        u.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+
+        auto buffer = MakeUniqueForOverwrite<int[]>(5);
+        buffer[4] = 42;
+        REQUIRE(buffer[4] == 42);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 template <typename T>
@@ -260,3 +260,17 @@ public:
 private:
     CompressedPair<T*, Deleter> data_;
 };
+
+// https://en.cppreference.com/w/cpp/memory/unique_ptr/make_unique
+// Default-initialize instead of value-initialize: large trivial buffers are not zeroed
+template <typename T>
+UniquePtr<T> MakeUniqueForOverwrite() {
+    static_assert(!std::is_array_v<T>, "Pass the element count");
+    return UniquePtr<T>(new T);
+}
+
+template <typename T>
+UniquePtr<T> MakeUniqueForOverwrite(std::size_t count) {
+    static_assert(std::is_array_v<T> && std::extent_v<T> == 0, "Only for T[]");
+    return UniquePtr<T>(new std::remove_extent_t<T>[count]);
+}